@@ -0,0 +1,248 @@
+#include "../project.h"
+#include "../utils.h"
+#include "../profiler.h"
+#include "../dep_cache.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib> // mkdtemp(), atoi()
+#include <unistd.h> // chdir(), unlink()
+#include <ftw.h> // nftw()
+#include <stdint.h>
+using namespace std;
+using namespace luacpp;
+
+/*
+  synthesizes a project tree and times omake phases on it. the tree has `depth` levels of
+  `fanout` static libraries each, and every library depends on all libraries of the next
+  level. the root project has `targets` binaries depending on the first level.
+*/
+struct BenchOptions final {
+    BenchOptions() : fanout(4), depth(4), targets(4), sources(8), runs(5), warm(false) {}
+    int fanout;
+    int depth;
+    int targets;
+    int sources; // per dependency
+    int runs;
+    bool warm; // keeps the dependency cache between runs
+};
+
+static bool WriteText(const string& fname, const string& content) {
+    ofstream ofs(fname.c_str(), ios_base::out | ios_base::trunc);
+    if (!ofs.is_open()) {
+        cerr << "open file [" << fname << "] failed: " << strerror(errno) << endl;
+        return false;
+    }
+    ofs << content;
+    return !ofs.fail();
+}
+
+static bool MakeSources(const string& dir, const string& prefix, int n) {
+    if (!MakeDirs(dir)) {
+        return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        const string func = prefix + "_" + std::to_string(i);
+        if (!WriteText(dir + "/" + func + ".cpp", "int " + func + "() { return " +
+                       std::to_string(i) + "; }\n")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static string LibName(int level, int idx) {
+    return "l" + std::to_string(level) + "_" + std::to_string(idx);
+}
+
+/* libraries of `level` that a project at `level` - 1 depends on */
+static string LibDeps(int level, const BenchOptions& opt) {
+    string content;
+    if (level > opt.depth) {
+        return content;
+    }
+    for (int i = 0; i < opt.fanout; ++i) {
+        const string name = LibName(level, i);
+        content += "        :AddStaticLibraries(\"../" + name + "\", \"" + name + "\")\n";
+    }
+    return content;
+}
+
+static bool SynthesizeProjects(const string& root, const BenchOptions& opt) {
+    for (int level = 1; level <= opt.depth; ++level) {
+        for (int i = 0; i < opt.fanout; ++i) {
+            const string name = LibName(level, i);
+            const string dir = root + "/" + name;
+            if (!MakeSources(dir, name, opt.sources)) {
+                return false;
+            }
+            const string content = "project = Project()\n\n"
+                "project:CreateStaticLibrary(\"" + name + "\"):AddDependencies(\n"
+                "    project:CreateDependency()\n"
+                "        :AddSourceFiles(\"*.cpp\")\n" + LibDeps(level + 1, opt) +
+                "        )\n\nreturn project\n";
+            if (!WriteText(dir + "/omake.lua", content)) {
+                return false;
+            }
+        }
+    }
+
+    const string app_dir = root + "/app";
+    string content = "project = Project()\n\n";
+    for (int i = 0; i < opt.targets; ++i) {
+        const string name = "t" + std::to_string(i);
+        if (!MakeSources(app_dir + "/" + name, name, opt.sources)) {
+            return false;
+        }
+        content += "project:CreateBinary(\"" + name + "\"):AddDependencies(\n"
+            "    project:CreateDependency()\n"
+            "        :AddSourceFiles(\"" + name + "/*.cpp\")\n" + LibDeps(1, opt) +
+            "        )\n\n";
+    }
+    content += "return project\n";
+
+    return WriteText(app_dir + "/omake.lua", content);
+}
+
+class BenchHelper final : public LuaFunctionHelper {
+public:
+    bool BeforeProcess(int nresults) override {
+        return (nresults == 1);
+    }
+    bool Process(int, const LuaObject& obj) override {
+        return obj.ToUserData().Get<Project>()->GenerateMakefile("Makefile");
+    }
+    void AfterProcess() override {}
+};
+
+struct PhaseResult final {
+    PhaseResult() : count(0), total_ns(0), min_ns(UINT64_MAX), max_ns(0) {}
+    uint64_t count; // calls per run
+    uint64_t total_ns;
+    uint64_t min_ns; // of a run
+    uint64_t max_ns;
+};
+
+static bool RunOnce(map<string, PhaseResult>* results) {
+    ProfilerReset();
+
+    bool ok;
+    {
+        ProfileScope scope("Total");
+        LuaState l;
+        InitLuaEnv(&l);
+        string errmsg;
+        BenchHelper helper;
+        ok = l.DoFile("omake.lua", &errmsg, &helper);
+        if (!ok) {
+            cerr << "DoFile error: " << errmsg << endl;
+        }
+    }
+
+    ProfilerForEachPhase([&results] (const char* name, uint64_t total_ns, uint64_t count) {
+        PhaseResult* res = &(*results)[name];
+        res->count = count;
+        res->total_ns += total_ns;
+        if (total_ns < res->min_ns) {
+            res->min_ns = total_ns;
+        }
+        if (total_ns > res->max_ns) {
+            res->max_ns = total_ns;
+        }
+    });
+
+    return ok;
+}
+
+static int RemoveEntry(const char* fpath, const struct stat*, int, struct FTW*) {
+    return remove(fpath);
+}
+
+static void PrintResults(const BenchOptions& opt, const map<string, PhaseResult>& results) {
+    cout << "{\"fanout\":" << opt.fanout << ",\"depth\":" << opt.depth
+         << ",\"targets\":" << opt.targets << ",\"sources\":" << opt.sources
+         << ",\"runs\":" << opt.runs << ",\"warm\":" << (opt.warm ? "true" : "false")
+         << ",\"phases\":[";
+    bool first = true;
+    for (auto& iter : results) {
+        const PhaseResult& res = iter.second;
+        cout << (first ? "" : ",") << "{\"name\":\"" << iter.first << "\",\"calls\":" << res.count
+             << ",\"mean_ns\":" << res.total_ns / opt.runs << ",\"min_ns\":" << res.min_ns
+             << ",\"max_ns\":" << res.max_ns << "}";
+        first = false;
+    }
+    cout << "]}" << endl;
+}
+
+static void PrintUsage(const char* prog) {
+    cerr << "usage: " << prog << " [fanout=N] [depth=N] [targets=N] [sources=N] [runs=N] [warm=y]" << endl;
+}
+
+static bool ParseOption(const char* arg, const char* key, int* value) {
+    const size_t klen = strlen(key);
+    if (strncmp(arg, key, klen) != 0 || arg[klen] != '=') {
+        return false;
+    }
+    *value = atoi(arg + klen + 1);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        if (ParseOption(argv[i], "fanout", &opt.fanout) ||
+            ParseOption(argv[i], "depth", &opt.depth) ||
+            ParseOption(argv[i], "targets", &opt.targets) ||
+            ParseOption(argv[i], "sources", &opt.sources) ||
+            ParseOption(argv[i], "runs", &opt.runs)) {
+            continue;
+        }
+        if (strcmp(argv[i], "warm=y") == 0) {
+            opt.warm = true;
+            continue;
+        }
+        PrintUsage(argv[0]);
+        return -1;
+    }
+    if (opt.fanout <= 0 || opt.depth < 0 || opt.targets <= 0 || opt.sources <= 0 ||
+        opt.runs <= 0) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    char root[] = "/tmp/omake_bench.XXXXXX";
+    if (!mkdtemp(root)) {
+        cerr << "mkdtemp failed: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    int ret = -1;
+    map<string, PhaseResult> results;
+    if (!SynthesizeProjects(root, opt)) {
+        goto end;
+    }
+    if (chdir((string(root) + "/app").c_str()) != 0) {
+        cerr << "chdir failed: " << strerror(errno) << endl;
+        goto end;
+    }
+
+    ProfilerEnable(true);
+    for (int i = 0; i < opt.runs; ++i) {
+        if (!opt.warm) {
+            unlink(OMAKE_DEP_CACHE_FILE);
+        }
+        if (!RunOnce(&results)) {
+            goto end;
+        }
+    }
+
+    PrintResults(opt, results);
+    ret = 0;
+
+end:
+    nftw(root, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return ret;
+}
@@ -0,0 +1,25 @@
+project = Project()
+
+-- omake itself, except main.cpp
+local omake = project:CreateDependency()
+    :AddSourceFiles({"../dep_cache.cpp", "../dependency.cpp", "../emitter.cpp", "../fs_cache.cpp",
+                     "../profiler.cpp", "../project.cpp", "../target.cpp",
+                     "../utils.cpp"})
+    :AddFlags({"-std=c++17", "-Wall", "-Werror", "-Wextra"})
+    :AddStaticLibraries("../../lua-cpp", "luacpp_static")
+    :AddStaticLibraries("../../cpputils", "cpputils_static")
+    :AddSysLibraries("pthread")
+
+project:CreateBinary("omake_bench"):AddDependencies({
+    project:CreateDependency()
+        :AddSourceFiles("bench.cpp")
+        :AddFlags({"-std=c++17", "-Wall", "-Werror", "-Wextra"}),
+    omake})
+
+project:CreateBinary("path_bench"):AddDependencies({
+    project:CreateDependency()
+        :AddSourceFiles("path_bench.cpp")
+        :AddFlags({"-std=c++17", "-Wall", "-Werror", "-Wextra"}),
+    omake})
+
+return project
@@ -0,0 +1,258 @@
+#include "../utils.h"
+#include "../profiler.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <cstring>
+#include <cstdlib> // atoi()
+#include <stdint.h>
+using namespace std;
+
+/*
+  checks RemoveDotAndDotDot() with and without its memo table against the original stack-based
+  implementation on random paths, along with a few properties of canonical paths, then times
+  all of them. `distinct` paths are drawn `paths` times, so that the memo table gets hits.
+*/
+struct PathBenchOptions final {
+    PathBenchOptions() : paths(200000), distinct(0), runs(5), seed(1) {}
+    int paths;
+    int distinct; // 0 means all paths are generated independently
+    int runs;
+    int seed;
+};
+
+/* the implementation before it was rewritten in place, kept as the reference */
+static string ReferenceRemoveDotAndDotDot(const string& path) {
+    vector<string> path_stack;
+    if (!path.empty() && path[0] == '/') {
+        path_stack.push_back("/");
+    }
+
+    for (size_t begin = 0; begin <= path.size();) {
+        size_t end = path.find('/', begin);
+        if (end == string::npos) {
+            end = path.size();
+        }
+        const string comp = path.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (comp.empty()) {
+            continue;
+        }
+
+        if (path_stack.empty()) {
+            path_stack.push_back(comp);
+        } else if (comp == ".") {
+            continue;
+        } else if (comp == "..") {
+            if (path_stack.back() == "..") {
+                path_stack.push_back(comp);
+            } else if (path_stack.back() == ".") {
+                path_stack.back() = comp;
+            } else if (path_stack.size() == 1 && path_stack[0] == "/") {
+                continue;
+            } else {
+                path_stack.pop_back();
+            }
+        } else if (path_stack.back() == ".") {
+            path_stack.back() = comp;
+        } else {
+            path_stack.push_back(comp);
+        }
+    }
+
+    if (path_stack.empty()) {
+        return string();
+    }
+
+    string new_path;
+    if (path_stack[0] != "/") {
+        new_path = path_stack[0];
+    }
+    for (size_t i = 1; i < path_stack.size(); ++i) {
+        new_path.append("/" + path_stack[i]);
+    }
+    return new_path;
+}
+
+/* `.`, `..` and empty components are frequent so that every branch is taken */
+static void GeneratePaths(const PathBenchOptions& opt, vector<string>* paths) {
+    static const char* comps[] = {"", ".", "..", "a", "bb", "src", "omake.lua", "...", ".x"};
+    const int nr_comps = sizeof(comps) / sizeof(comps[0]);
+
+    mt19937 rng(opt.seed);
+    const int nr_distinct = (opt.distinct > 0) ? opt.distinct : opt.paths;
+    paths->reserve(opt.paths);
+    for (int i = 0; i < nr_distinct; ++i) {
+        string path;
+        if (rng() % 2 == 0) {
+            path = "/";
+        }
+        const int n = rng() % 12;
+        for (int j = 0; j < n; ++j) {
+            if (j > 0) {
+                path += "/";
+            }
+            path += comps[rng() % nr_comps];
+        }
+        if (rng() % 8 == 0) {
+            path += "/";
+        }
+        paths->push_back(path);
+    }
+    for (int i = nr_distinct; i < opt.paths; ++i) {
+        paths->push_back((*paths)[rng() % nr_distinct]);
+    }
+}
+
+/* returns an empty string if `res`, the canonical form of `path`, looks fine */
+static string CheckProperties(const string& path, const string& res) {
+    if (RemoveDotAndDotDot(res) != res) {
+        return "not idempotent";
+    }
+
+    const bool is_abs = (!path.empty() && path[0] == '/');
+    // absolute paths lose the leading '/' only when they are the root
+    if (is_abs && !res.empty() && res[0] != '/') {
+        return "absolute path becomes relative";
+    }
+    if (!is_abs && !res.empty() && res[0] == '/') {
+        return "relative path becomes absolute";
+    }
+
+    bool leading_dotdot = !is_abs;
+    for (size_t begin = (is_abs ? 1 : 0); begin < res.size();) {
+        size_t end = res.find('/', begin);
+        if (end == string::npos) {
+            end = res.size();
+        }
+        const string comp = res.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (comp.empty()) {
+            return "empty component";
+        }
+        if (comp == "." && res != ".") {
+            return "`.` component";
+        }
+        if (comp == "..") {
+            if (!leading_dotdot) {
+                return "`..` after a normal component";
+            }
+        } else {
+            leading_dotdot = false;
+        }
+    }
+    if (!res.empty() && res.back() == '/') {
+        return "trailing '/'";
+    }
+
+    return string();
+}
+
+static int CheckPaths(const vector<string>& paths) {
+    int nr_failed = 0;
+    for (auto& path : paths) {
+        const string expected = ReferenceRemoveDotAndDotDot(path);
+        const string res = RemoveDotAndDotDot(path);
+        const string memo_res = RemoveDotAndDotDotMemo(path);
+        string err;
+        if (res != expected) {
+            err = "expected [" + expected + "]";
+        } else if (memo_res != expected) {
+            err = "memoized [" + memo_res + "], expected [" + expected + "]";
+        } else {
+            err = CheckProperties(path, res);
+        }
+        if (!err.empty()) {
+            if (nr_failed < 10) {
+                cerr << "[" << path << "] -> [" << res << "]: " << err << endl;
+            }
+            ++nr_failed;
+        }
+    }
+    return nr_failed;
+}
+
+static void RunOnce(const vector<string>& paths, size_t* sink) {
+    {
+        ProfileScope scope("reference");
+        for (auto& path : paths) {
+            *sink += ReferenceRemoveDotAndDotDot(path).size();
+        }
+    }
+    {
+        ProfileScope scope("current");
+        for (auto& path : paths) {
+            *sink += RemoveDotAndDotDot(path).size();
+        }
+    }
+    {
+        ProfileScope scope("memo");
+        for (auto& path : paths) {
+            *sink += RemoveDotAndDotDotMemo(path).size();
+        }
+    }
+}
+
+static void PrintUsage(const char* prog) {
+    cerr << "usage: " << prog << " [paths=N] [distinct=N] [runs=N] [seed=N]" << endl;
+}
+
+static bool ParseOption(const char* arg, const char* key, int* value) {
+    const size_t klen = strlen(key);
+    if (strncmp(arg, key, klen) != 0 || arg[klen] != '=') {
+        return false;
+    }
+    *value = atoi(arg + klen + 1);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    PathBenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        if (ParseOption(argv[i], "paths", &opt.paths) ||
+            ParseOption(argv[i], "distinct", &opt.distinct) ||
+            ParseOption(argv[i], "runs", &opt.runs) ||
+            ParseOption(argv[i], "seed", &opt.seed)) {
+            continue;
+        }
+        PrintUsage(argv[0]);
+        return -1;
+    }
+    if (opt.paths <= 0 || opt.distinct < 0 || opt.runs <= 0) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    vector<string> paths;
+    GeneratePaths(opt, &paths);
+
+    const int nr_failed = CheckPaths(paths);
+    if (nr_failed > 0) {
+        cerr << nr_failed << " of " << paths.size() << " paths failed" << endl;
+        return -1;
+    }
+
+    size_t sink = 0;
+    ProfilerEnable(true);
+    for (int i = 0; i < opt.runs; ++i) {
+        RunOnce(paths, &sink);
+    }
+
+    map<string, uint64_t> total_ns;
+    ProfilerForEachPhase([&total_ns] (const char* name, uint64_t ns, uint64_t) {
+        total_ns[name] = ns;
+    });
+
+    cout << "{\"paths\":" << opt.paths << ",\"distinct\":" << opt.distinct << ",\"runs\":"
+         << opt.runs << ",\"seed\":" << opt.seed << ",\"failed\":0,\"reference_ns_per_path\":"
+         << (double)total_ns["reference"] / opt.runs / opt.paths
+         << ",\"current_ns_per_path\":" << (double)total_ns["current"] / opt.runs / opt.paths
+         << ",\"memo_ns_per_path\":" << (double)total_ns["memo"] / opt.runs / opt.paths
+         << ",\"checksum\":" << sink << "}" << endl;
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include "dep_cache.h"
+#include "utils.h"
+#include "profiler.h"
+#include "fs_cache.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio> // snprintf()
+#include <cstdlib> // atoi()
+using namespace std;
+
+#define CACHE_MAGIC "# omake dependency cache v2"
+
+/* ------------------------------------------------------------------------- */
+
+static inline void Fnv1a(const char* data, size_t len, unsigned long long* h) {
+    for (size_t i = 0; i < len; ++i) {
+        *h ^= (unsigned char)data[i];
+        *h *= 0x100000001b3ULL;
+    }
+}
+
+static bool HashFile(const string& fpath, unsigned long long* h) {
+    ifstream ifs(fpath, ios_base::in | ios_base::binary);
+    if (!ifs.is_open()) {
+        return false;
+    }
+
+    char buf[8192];
+    while (ifs.read(buf, sizeof(buf)) || ifs.gcount() > 0) {
+        Fnv1a(buf, ifs.gcount(), h);
+    }
+    return true;
+}
+
+/* only names are hashed: adding or removing a file changes the result */
+static bool HashDirEntries(const string& dirname, unsigned long long* h) {
+    const FsDirListing* listing = FsListDir(dirname);
+    if (listing->err != 0) {
+        return false;
+    }
+
+    for (auto& entry : listing->entries) {
+        Fnv1a(entry.name.c_str(), entry.name.size() + 1, h); // including '\0' as separator
+    }
+    return true;
+}
+
+static string CalcKey(const string& dir, const set<string>& glob_dirs) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+
+    if (!HashFile(dir + "/omake.lua", &h)) {
+        return string();
+    }
+
+    for (auto& gdir : glob_dirs) {
+        const string real_dir = (gdir[0] == '/') ? gdir : (dir + "/" + gdir);
+        Fnv1a(gdir.c_str(), gdir.size() + 1, &h);
+        if (!HashDirEntries(real_dir, &h)) {
+            return string();
+        }
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016llx", h);
+    return string(buf);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void SplitByTab(const string& line, vector<string>* fields) {
+    size_t start = 0;
+    while (true) {
+        size_t pos = line.find('\t', start);
+        if (pos == string::npos) {
+            fields->push_back(line.substr(start));
+            break;
+        }
+        fields->push_back(line.substr(start, pos - start));
+        start = pos + 1;
+    }
+}
+
+bool DepCache::Load(const string& fname) {
+    ProfileScope scope("DepCache::Load");
+
+    ifstream ifs(fname);
+    if (!ifs.is_open()) {
+        return false;
+    }
+
+    string line;
+    if (!getline(ifs, line) || line != CACHE_MAGIC) {
+        cerr << "ignore incompatible cache file [" << fname << "]" << endl;
+        return false;
+    }
+
+    CachedProject* proj = nullptr;
+    CachedTarget* target = nullptr;
+    CachedDependency* dep = nullptr;
+    vector<string> fields;
+
+    while (getline(ifs, line)) {
+        fields.clear();
+        SplitByTab(line, &fields);
+
+        if (fields[0] == "project" && fields.size() == 3) {
+            proj = &m_projects[fields[1]];
+            proj->key = fields[2];
+            target = nullptr;
+            dep = nullptr;
+        } else if (proj && fields[0] == "glob" && fields.size() == 2) {
+            proj->glob_dirs.insert(fields[1]);
+        } else if (proj && fields[0] == "target" && fields.size() == 3) {
+            target = &proj->targets[fields[1]];
+            target->type = atoi(fields[2].c_str());
+            dep = nullptr;
+        } else if (target && fields[0] == "dep" && fields.size() == 3) {
+            target->deps.push_back(CachedDependency());
+            dep = &target->deps.back();
+            dep->name = fields[1];
+            dep->unity_batch_size = atoi(fields[2].c_str());
+        } else if (dep && fields[0] == "flag" && fields.size() == 2) {
+            dep->flags.push_back(fields[1]);
+        } else if (dep && fields[0] == "c" && fields.size() == 2) {
+            dep->c_sources.push_back(fields[1]);
+        } else if (dep && fields[0] == "cpp" && fields.size() == 2) {
+            dep->cpp_sources.push_back(fields[1]);
+        } else if (dep && fields[0] == "inc" && fields.size() == 2) {
+            dep->inc_dirs.push_back(fields[1]);
+        } else if (dep && fields[0] == "lib" && fields.size() == 4) {
+            dep->libs.push_back(LibInfo(fields[2], fields[3], atoi(fields[1].c_str())));
+        } else if (dep && fields[0] == "pch" && fields.size() == 2) {
+            dep->pch = fields[1];
+        } else if (dep && fields[0] == "unity_exclude" && fields.size() == 2) {
+            dep->unity_excludes.push_back(fields[1]);
+        } else {
+            cerr << "invalid line [" << line << "] in cache file ["
+                 << fname << "], cache is discarded." << endl;
+            m_projects.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DepCache::Save(const string& fname) {
+    ProfileScope scope("DepCache::Save");
+
+    if (!m_dirty) {
+        return true;
+    }
+
+    const string::size_type pos = fname.rfind('/');
+    if (pos != string::npos) {
+        if (!MakeDirs(fname.substr(0, pos))) {
+            return false;
+        }
+    }
+
+    ofstream ofs(fname, ios_base::out | ios_base::trunc);
+    if (!ofs.is_open()) {
+        cerr << "open cache file [" << fname << "] failed." << endl;
+        return false;
+    }
+
+    ofs << CACHE_MAGIC << "\n";
+    for (auto& it : m_projects) {
+        const CachedProject& proj = it.second;
+        ofs << "project\t" << it.first << "\t" << proj.key << "\n";
+        for (auto& gdir : proj.glob_dirs) {
+            ofs << "glob\t" << gdir << "\n";
+        }
+        for (auto& tit : proj.targets) {
+            ofs << "target\t" << tit.first << "\t" << tit.second.type << "\n";
+            for (auto& dep : tit.second.deps) {
+                ofs << "dep\t" << dep.name << "\t" << dep.unity_batch_size << "\n";
+                for (auto& flag : dep.flags) {
+                    ofs << "flag\t" << flag << "\n";
+                }
+                for (auto& src : dep.c_sources) {
+                    ofs << "c\t" << src << "\n";
+                }
+                for (auto& src : dep.cpp_sources) {
+                    ofs << "cpp\t" << src << "\n";
+                }
+                for (auto& inc : dep.inc_dirs) {
+                    ofs << "inc\t" << inc << "\n";
+                }
+                for (auto& lib : dep.libs) {
+                    ofs << "lib\t" << lib.type << "\t" << lib.path << "\t" << lib.name << "\n";
+                }
+                if (!dep.pch.empty()) {
+                    ofs << "pch\t" << dep.pch << "\n";
+                }
+                for (auto& src : dep.unity_excludes) {
+                    ofs << "unity_exclude\t" << src << "\n";
+                }
+            }
+        }
+    }
+
+    m_dirty = false;
+    return true;
+}
+
+const CachedProject* DepCache::Find(const string& dir) {
+    auto ref = m_projects.find(dir);
+    if (ref == m_projects.end()) {
+        return nullptr;
+    }
+
+    CachedProject* proj = &ref->second;
+    if (!proj->verified) {
+        if (proj->key.empty() || CalcKey(dir, proj->glob_dirs) != proj->key) {
+            m_projects.erase(ref);
+            m_dirty = true;
+            return nullptr;
+        }
+        proj->verified = true;
+    }
+
+    return proj;
+}
+
+const CachedProject* DepCache::Update(const string& dir, CachedProject&& proj) {
+    proj.key = CalcKey(dir, proj.glob_dirs);
+    proj.verified = true;
+
+    CachedProject* res = &m_projects[dir];
+    *res = std::move(proj);
+    m_dirty = true;
+    return res;
+}
+
+void DepCache::Erase(const string& dir) {
+    if (m_projects.erase(dir) > 0) {
+        m_dirty = true;
+    }
+}
+
+void DepCache::Unverify(const string& dir) {
+    auto ref = m_projects.find(dir);
+    if (ref != m_projects.end()) {
+        ref->second.verified = false;
+    }
+}
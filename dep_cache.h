@@ -0,0 +1,64 @@
+#ifndef __OMAKE_DEP_CACHE_H__
+#define __OMAKE_DEP_CACHE_H__
+
+#include "dependency.h"
+#include "common.h"
+#include <map>
+
+#define OMAKE_DEP_CACHE_FILE ".omake/cache"
+
+/* paths are relative to the project dir */
+struct CachedDependency final {
+    CachedDependency() : unity_batch_size(0) {}
+
+    std::string name;
+    std::vector<std::string> flags;
+    std::vector<std::string> c_sources;
+    std::vector<std::string> cpp_sources;
+    std::vector<std::string> inc_dirs;
+    std::vector<LibInfo> libs;
+    std::string pch;
+    int unity_batch_size; // with the project default applied
+    std::vector<std::string> unity_excludes;
+};
+
+struct CachedTarget final {
+    CachedTarget() : type(OMAKE_TYPE_BINARY) {}
+
+    int type;
+    std::vector<CachedDependency> deps;
+};
+
+struct CachedProject final {
+    CachedProject() : verified(false) {}
+
+    std::string key; // hash of `omake.lua` and listings of `glob_dirs`
+    std::set<std::string> glob_dirs; // relative to the project dir
+    std::map<std::string, CachedTarget> targets;
+    bool verified; // `key` has been checked in this run
+};
+
+class DepCache final {
+public:
+    DepCache() : m_dirty(false) {}
+
+    bool Load(const std::string& fname);
+    bool Save(const std::string& fname);
+
+    // returns nullptr if `dir` is not cached or its inputs have changed
+    const CachedProject* Find(const std::string& dir);
+    const CachedProject* Update(const std::string& dir, CachedProject&& proj);
+    void Erase(const std::string& dir);
+    // the key of `dir` is checked again by the next Find()
+    void Unverify(const std::string& dir);
+
+private:
+    bool m_dirty;
+    std::map<std::string, CachedProject> m_projects;
+
+private:
+    DepCache(const DepCache&);
+    DepCache& operator=(const DepCache&);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __OMAKE_DEP_TREE_H__
+#define __OMAKE_DEP_TREE_H__
+
+#include "dependency.h"
+#include <set>
+#include <vector>
+#include <unordered_map>
+
+struct DepTreeNode final {
+    DepTreeNode(const LibInfo& _lib) : lib(_lib) {}
+
+    LibInfo lib;
+    std::set<std::string> inc_dirs;
+    std::vector<int> deps; // ids of dependencies, keep order of insertion
+};
+
+/*
+  libraries are interned to dense ids in [0, size of the tree), which index `nodes` and
+  per-node arrays such as in-degrees. edges are ids as well.
+*/
+struct DepTree final {
+    /* returns the id of `lib` and whether it is newly inserted */
+    std::pair<int, bool> Intern(const LibInfo& lib) {
+        auto ret_pair = ids.insert(std::make_pair(lib, (int)nodes.size()));
+        if (ret_pair.second) {
+            nodes.emplace_back(lib);
+        }
+        return std::make_pair(ret_pair.first->second, ret_pair.second);
+    }
+
+    /* `lib` must be in the tree */
+    int Id(const LibInfo& lib) const {
+        return ids.find(lib)->second;
+    }
+
+    std::vector<DepTreeNode> nodes;
+    std::unordered_map<LibInfo, int, LibInfoHash> ids;
+};
+
+#endif
@@ -1,7 +1,8 @@
 #include "dependency.h"
 #include "utils.h"
-#include <sys/types.h>
-#include <dirent.h>
+#include "profiler.h"
+#include "fs_cache.h"
+#include <fnmatch.h>
 #include <iostream>
 #include <algorithm>
 #include <cstring> // strerror()
@@ -10,86 +11,233 @@ using namespace std;
 #include "cpputils/text_utils.h"
 using namespace outils;
 
-static void AddFileEndsWith(const string& dirname, const char* suffix,
-                            set<string>* file_set) {
-    DIR* dirp = opendir(dirname.c_str());
-    if (!dirp) {
-        cerr << "Dependency opendir [" << dirname << "] failed: "
-             << strerror(errno) << endl;
+static inline bool HasWildcard(const string& s) {
+    return (s.find_first_of("*?[") != string::npos);
+}
+
+static vector<string> SplitPath(const string& path) {
+    vector<string> parts;
+    TextSplit(path.data(), path.size(), "/", 1, [&parts] (const char* s, unsigned int l) -> bool {
+        if (l > 0) {
+            parts.push_back(string(s, l));
+        }
+        return true;
+    });
+    return parts;
+}
+
+/* like shells, wildcards do not match a leading dot */
+static inline bool MatchComponent(const string& pattern, const char* name) {
+    return (fnmatch(pattern.c_str(), name, FNM_PERIOD) == 0);
+}
+
+/* `**` matches zero or more directories */
+static bool MatchPath(const vector<string>& parts, size_t pi,
+                      const vector<string>& comps, size_t ci) {
+    if (pi == parts.size()) {
+        return (ci == comps.size());
+    }
+
+    if (parts[pi] == "**") {
+        for (size_t i = ci; i <= comps.size(); ++i) {
+            if (MatchPath(parts, pi + 1, comps, i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (ci == comps.size() || !MatchComponent(parts[pi], comps[ci].c_str())) {
+        return false;
+    }
+    return MatchPath(parts, pi + 1, comps, ci + 1);
+}
+
+struct GlobContext final {
+    GlobContext() : parts(nullptr), files(nullptr), dirs(nullptr), nr_scanned(0) {}
+    const vector<string>* parts;
+    vector<string>* files;
+    set<string>* dirs;
+    int nr_scanned;
+};
+
+/*
+  `states` are indices of `parts` that entries of `dirname` are matched against, so that
+  every directory is listed only once however many `**` it is reachable by.
+*/
+static void GlobWalk(const string& real_dir, const string& dirname, vector<size_t> states,
+                     GlobContext* ctx) {
+    const vector<string>& parts = *ctx->parts;
+    const size_t last = parts.size() - 1;
+
+    // `**` also matches zero directories
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (parts[states[i]] == "**" && states[i] < last) {
+            states.push_back(states[i] + 1);
+        }
+    }
+
+    const FsDirListing* listing = FsListDir(real_dir);
+    if (listing->err != 0) {
+        cerr << "Dependency opendir [" << real_dir << "] failed: " << strerror(listing->err) << endl;
         return;
     }
+    ctx->dirs->insert(dirname);
+
+    for (auto& entry : listing->entries) {
+        const char* name = entry.name.c_str();
+        ++ctx->nr_scanned;
+
+        const string path = (dirname == ".") ? entry.name : (dirname + "/" + entry.name);
+
+        if (entry.is_file) {
+            for (auto s : states) {
+                if (s == last && (parts[s] == "**" ? (name[0] != '.') : MatchComponent(parts[s], name))) {
+                    ctx->files->push_back(path);
+                    break;
+                }
+            }
+            continue;
+        }
+
+        if (!entry.is_dir) {
+            continue;
+        }
 
-    struct dirent* dentry;
-    const int slen = strlen(suffix);
-    while ((dentry = readdir(dirp))) {
-        int dlen = strlen(dentry->d_name);
-        if (TextEndsWith(dentry->d_name, dlen, suffix, slen)) {
-            const string fpath = dirname + "/" + string(dentry->d_name, dlen);
-            auto ret_pair = file_set->insert(RemoveDotAndDotDot(fpath));
-            if (!ret_pair.second) {
-                cerr << "duplicated source file [" << fpath << "]" << endl;
+        vector<size_t> child_states;
+        for (auto s : states) {
+            if (parts[s] == "**") {
+                // symlinks to directories may form loops
+                if (name[0] != '.' && !entry.is_link) {
+                    child_states.push_back(s);
+                }
+            } else if (s < last && MatchComponent(parts[s], name)) {
+                child_states.push_back(s + 1);
             }
         }
+        if (child_states.empty()) {
+            continue;
+        }
+
+        sort(child_states.begin(), child_states.end());
+        child_states.erase(unique(child_states.begin(), child_states.end()), child_states.end());
+
+        GlobWalk(real_dir + "/" + entry.name, path, std::move(child_states), ctx);
+    }
+}
+
+/*
+  `pattern` is relative to `base_dir` and so are the files found and the dirs scanned.
+  the leading components without wildcards are not listed.
+*/
+static void GlobFiles(const string& base_dir, const string& pattern,
+                      vector<string>* files, set<string>* dirs) {
+    const vector<string> all_parts = SplitPath(pattern);
+
+    string dirname = (pattern[0] == '/') ? "/" : "";
+    size_t i = 0;
+    for (; i < all_parts.size() - 1 && !HasWildcard(all_parts[i]); ++i) {
+        if (!dirname.empty() && dirname != "/") {
+            dirname += "/";
+        }
+        dirname += all_parts[i];
+    }
+    if (dirname.empty()) {
+        dirname = ".";
     }
 
-    closedir(dirp);
+    const string real_dir = (dirname[0] == '/' || base_dir == ".")
+        ? dirname : (base_dir + "/" + dirname);
+    ProfileScope scope("GlobFiles", real_dir);
+
+    const vector<string> parts(all_parts.begin() + i, all_parts.end());
+    GlobContext ctx;
+    ctx.parts = &parts;
+    ctx.files = files;
+    ctx.dirs = dirs;
+    GlobWalk(real_dir, dirname, vector<size_t>(1, 0), &ctx);
+
+    // a depth-first walk does not order "a/b" and "a-b" like strings
+    sort(files->begin(), files->end());
+    ProfilerCount("files scanned", ctx.nr_scanned);
 }
 
 void Dependency::AddFlag(const char* flag) {
-    auto it = std::find(m_flags.begin(), m_flags.end(), string(flag));
-    if (it == m_flags.end()) {
+    if (m_flag_set.insert(flag).second) {
         m_flags.push_back(flag);
     } else {
         cerr << "AddFlag(): duplicated flag [" << flag << "]" << endl;
     }
 }
 
-void Dependency::AddSourceFiles(const char* fpath) {
-    string parent_dir;
-    const char* fname = nullptr;
+bool Dependency::IsExcludedSource(const string& fpath) const {
+    if (m_source_excludes.empty()) {
+        return false;
+    }
 
-    int offset = FindParentDirPos(fpath, strlen(fpath));
-    if (offset >= 0) {
-        parent_dir.assign(fpath, offset + 1);
-        fname = fpath + offset + 1;
-    } else {
-        parent_dir = ".";
-        fname = fpath;
+    const vector<string> comps = SplitPath(fpath);
+    for (auto& pattern : m_source_excludes) {
+        if (MatchPath(SplitPath(pattern), 0, comps, 0)) {
+            return true;
+        }
     }
+    return false;
+}
 
-    int flen = strlen(fname);
+void Dependency::AddSourceFile(const string& fpath) {
+    if (IsExcludedSource(fpath)) {
+        return;
+    }
 
-    if (strcmp(fname, "*.cpp") == 0) {
-        AddFileEndsWith(parent_dir, ".cpp", &m_cpp_sources);
-    } else if (strcmp(fname, "*.c") == 0) {
-        AddFileEndsWith(parent_dir, ".c", &m_c_sources);
-    } else if (strcmp(fname, "*.cc") == 0) {
-        AddFileEndsWith(parent_dir, ".cc", &m_cpp_sources);
+    set<string>* file_set = nullptr;
+    if (TextEndsWith(fpath.data(), fpath.size(), ".cpp", 4) ||
+        TextEndsWith(fpath.data(), fpath.size(), ".cc", 3)) {
+        file_set = &m_cpp_sources;
+    } else if (TextEndsWith(fpath.data(), fpath.size(), ".c", 2)) {
+        file_set = &m_c_sources;
     } else {
-        if (TextEndsWith(fname, flen, ".cpp", 4) ||
-            TextEndsWith(fname, flen, ".cc", 3)) {
-            auto ret_pair = m_cpp_sources.insert(RemoveDotAndDotDot(fpath));
-            if (!ret_pair.second) {
-                cerr << "duplicated source file [" << fpath << "]" << endl;
-            }
-        } else if (TextEndsWith(fname, flen, ".c", 2)) {
-            auto ret_pair = m_c_sources.insert(RemoveDotAndDotDot(fpath));
-            if (!ret_pair.second) {
-                cerr << "duplicated source file [" << fpath << "]" << endl;
+        return;
+    }
+
+    auto ret_pair = file_set->insert(fpath);
+    if (!ret_pair.second) {
+        cerr << "duplicated source file [" << fpath << "]" << endl;
+    }
+}
+
+/* files matching `pattern`, including those added later, are excluded */
+void Dependency::ExcludeSourceFiles(const string& pattern) {
+    m_source_excludes.push_back(pattern);
+
+    const vector<string> parts = SplitPath(pattern);
+    for (auto file_set : {&m_c_sources, &m_cpp_sources}) {
+        for (auto it = file_set->begin(); it != file_set->end();) {
+            if (MatchPath(parts, 0, SplitPath(*it), 0)) {
+                it = file_set->erase(it);
+            } else {
+                ++it;
             }
         }
     }
 }
 
-static bool EmplaceLibInfo(LibInfo&& lib, vector<LibInfo>* libs) {
-    for (auto iter = libs->begin(); iter != libs->end(); ++iter) {
-        if (*iter == lib) {
-            return false;
-        }
+void Dependency::AddSourceFiles(const char* fpath) {
+    if (fpath[0] == '!') {
+        ExcludeSourceFiles(RemoveDotAndDotDot(fpath + 1));
+        return;
     }
 
-    libs->push_back(std::move(lib));
-    return true;
+    const string pattern = RemoveDotAndDotDot(fpath);
+    if (!HasWildcard(pattern)) {
+        AddSourceFile(pattern);
+        return;
+    }
+
+    vector<string> files;
+    GlobFiles(m_base_dir, pattern, &files, &m_glob_dirs);
+    for (auto& file : files) {
+        AddSourceFile(file);
+    }
 }
 
 void Dependency::AddLibrary(const char* path, const char* name, int type) {
@@ -98,11 +246,13 @@ void Dependency::AddLibrary(const char* path, const char* name, int type) {
     if (path) {
         const unsigned int plen = strlen(path);
         unsigned int chars_removed = TextTrim(path, plen, '/');
-        new_path = RemoveDotAndDotDot(string(path, plen - chars_removed));
+        new_path = RemoveDotAndDotDot(string_view(path, plen - chars_removed));
     }
 
     LibInfo lib(new_path, name, type);
-    if (!EmplaceLibInfo(std::move(lib), &m_libs)) {
+    if (m_lib_set.insert(lib).second) {
+        m_libs.push_back(std::move(lib));
+    } else {
         cerr << "AddLibrary(): duplicated lib [" << name << "]" << endl;
     }
 }
@@ -111,13 +261,30 @@ void Dependency::AddIncludeDirectory(const char* name) {
     const unsigned int namelen = strlen(name);
     unsigned int chars_removed = TextTrim(name, namelen, '/');
     auto ret_pair = m_inc_dirs.insert(
-        RemoveDotAndDotDot(string(name, namelen - chars_removed)));
+        RemoveDotAndDotDot(string_view(name, namelen - chars_removed)));
     if (!ret_pair.second) {
         cerr << "AddIncludeDirectory(): duplicated include directory ["
              << name << "]" << endl;
     }
 }
 
+void Dependency::AddPrecompiledHeader(const char* header) {
+    if (!m_pch.empty()) {
+        cerr << "AddPrecompiledHeader(): precompiled header [" << m_pch
+             << "] exists, [" << header << "] is ignored." << endl;
+        return;
+    }
+
+    m_pch = RemoveDotAndDotDot(header);
+}
+
+void Dependency::ExcludeFromUnityBuild(const char* file) {
+    auto ret_pair = m_unity_excludes.insert(RemoveDotAndDotDot(file));
+    if (!ret_pair.second) {
+        cerr << "ExcludeFromUnityBuild(): duplicated file [" << file << "]" << endl;
+    }
+}
+
 void Dependency::ForEachFlag(const function<void (const string&)>& f) const {
     for (auto flag : m_flags) {
         f(flag);
@@ -147,3 +314,15 @@ void Dependency::ForEachLibrary(const function<void (const LibInfo&)>& f) const
         f(lib);
     }
 }
+
+void Dependency::ForEachGlobDir(const function<void (const string&)>& f) const {
+    for (auto dir : m_glob_dirs) {
+        f(dir);
+    }
+}
+
+void Dependency::ForEachUnityExclude(const function<void (const string&)>& f) const {
+    for (auto src : m_unity_excludes) {
+        f(src);
+    }
+}
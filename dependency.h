@@ -5,6 +5,7 @@
 #include <vector>
 #include <functional>
 #include <set>
+#include <unordered_set>
 
 struct LibInfo final {
     int type;
@@ -20,39 +21,73 @@ struct LibInfo final {
 };
 
 struct LibInfoHash final {
-    unsigned long operator () (const LibInfo& info) const {
-        return std::hash<std::string>()(info.path) +
-            std::hash<std::string>()(info.name) +
-            info.type;
+    /* like boost::hash_combine(). a plain sum makes swapped path and name collide. */
+    static void Combine(size_t* seed, size_t h) {
+        *seed ^= h + 0x9e3779b9 + (*seed << 6) + (*seed >> 2);
+    }
+
+    size_t operator () (const LibInfo& info) const {
+        size_t seed = std::hash<std::string>()(info.path);
+        Combine(&seed, std::hash<std::string>()(info.name));
+        Combine(&seed, std::hash<int>()(info.type));
+        return seed;
     }
 };
 
 class Dependency final {
 public:
-    Dependency(const std::string& name) : m_name(name) {}
+    /* relative paths passed to Add*() are relative to `base_dir` */
+    Dependency(const std::string& name, const std::string& base_dir)
+        : m_name(name), m_base_dir(base_dir), m_unity_batch_size(-1) {}
 
     void AddFlag(const char* flag);
+    /* `file` may contain wildcards and `**`. a leading `!` excludes matched files. */
     void AddSourceFiles(const char* file);
+    /* `fpath` is used as is, without wildcards, e.g. sources loaded from the dep cache */
+    void AddSourceFile(const std::string& fpath);
     void AddLibrary(const char* path, const char* name, int type);
     void AddIncludeDirectory(const char* path);
+    void AddPrecompiledHeader(const char* header);
+    void EnableUnityBuild(int batch_size) { m_unity_batch_size = batch_size; }
+    void ExcludeFromUnityBuild(const char* file);
 
     const std::string& GetName() const { return m_name; }
+    bool HasFlag(const std::string& flag) const { return (m_flag_set.find(flag) != m_flag_set.end()); }
     bool HasCSource() const { return (!m_c_sources.empty()); }
     bool HasCppSource() const { return (!m_cpp_sources.empty()); }
+    const std::string& GetPrecompiledHeader() const { return m_pch; }
+    int GetUnityBatchSize() const { return m_unity_batch_size; }
+    bool IsExcludedFromUnityBuild(const std::string& src) const {
+        return (m_unity_excludes.find(src) != m_unity_excludes.end());
+    }
 
     void ForEachFlag(const std::function<void (const std::string&)>&) const;
     void ForEachCSource(const std::function<void (const std::string&)>&) const;
     void ForEachCppSource(const std::function<void (const std::string&)>&) const;
     void ForEachIncDir(const std::function<void (const std::string&)>&) const;
     void ForEachLibrary(const std::function<void (const LibInfo&)>&) const;
+    void ForEachGlobDir(const std::function<void (const std::string&)>&) const;
+    void ForEachUnityExclude(const std::function<void (const std::string&)>&) const;
+
+private:
+    void ExcludeSourceFiles(const std::string& pattern);
+    bool IsExcludedSource(const std::string& fpath) const;
 
 private:
     std::string m_name;
+    std::string m_base_dir;
     std::set<std::string> m_c_sources;
     std::set<std::string> m_cpp_sources;
     std::set<std::string> m_inc_dirs;
-    std::vector<std::string> m_flags;
+    std::set<std::string> m_glob_dirs; // dirs scanned by wildcard patterns
+    std::vector<std::string> m_source_excludes;
+    std::vector<std::string> m_flags; // keep order of insertion
+    std::unordered_set<std::string> m_flag_set; // index of `m_flags`
     std::vector<LibInfo> m_libs; // keep order of insertion
+    std::unordered_set<LibInfo, LibInfoHash> m_lib_set; // index of `m_libs`
+    std::string m_pch; // empty if no precompiled header is used
+    int m_unity_batch_size; // -1 means following the project, 0 means disabled
+    std::set<std::string> m_unity_excludes;
 
 private:
     Dependency(const Dependency&);
@@ -0,0 +1,145 @@
+#include "emitter.h"
+#include "profiler.h"
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio> // rename()
+using namespace std;
+
+#define EMITTER_BUF_SIZE (64 * 1024)
+
+Emitter::Emitter()
+    : m_fd(-1), m_old_fd(-1), m_failed(false), m_total(0), m_buf(EMITTER_BUF_SIZE),
+      m_buf_size(0) {}
+
+Emitter::~Emitter() {
+    // not committed
+    if (m_fd >= 0) {
+        Close();
+        unlink(m_tmp_fname.c_str());
+    }
+}
+
+string Emitter::TempFileName(const string& fname) {
+    return fname + ".tmp." + std::to_string(getpid());
+}
+
+bool Emitter::Open(const string& fname) {
+    m_fname = fname;
+    m_tmp_fname = TempFileName(fname);
+
+    m_fd = open(m_tmp_fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        cerr << "open [" << m_tmp_fname << "] failed: " << strerror(errno) << endl;
+        return false;
+    }
+
+    m_old_fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_old_fd >= 0) {
+        m_cmp_buf.resize(EMITTER_BUF_SIZE);
+    }
+    return true;
+}
+
+static bool ReadFull(int fd, char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = read(fd, buf, len);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+void Emitter::Flush() {
+    if (m_buf_size == 0) {
+        return;
+    }
+
+    if (m_old_fd >= 0) {
+        if (!ReadFull(m_old_fd, m_cmp_buf.data(), m_buf_size) ||
+            memcmp(m_cmp_buf.data(), m_buf.data(), m_buf_size) != 0) {
+            close(m_old_fd);
+            m_old_fd = -1;
+        }
+    }
+
+    const char* data = m_buf.data();
+    size_t len = m_buf_size;
+    while (len > 0 && !m_failed) {
+        ssize_t ret = write(m_fd, data, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "write [" << m_tmp_fname << "] failed: " << strerror(errno) << endl;
+            m_failed = true;
+            break;
+        }
+        data += ret;
+        len -= ret;
+    }
+
+    m_buf_size = 0;
+}
+
+void Emitter::Append(const char* data, size_t len) {
+    m_total += len;
+    while (len > 0) {
+        size_t n = m_buf.size() - m_buf_size;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(m_buf.data() + m_buf_size, data, n);
+        m_buf_size += n;
+        data += n;
+        len -= n;
+        if (m_buf_size == m_buf.size()) {
+            Flush();
+        }
+    }
+}
+
+void Emitter::Close() {
+    if (m_old_fd >= 0) {
+        close(m_old_fd);
+        m_old_fd = -1;
+    }
+    if (close(m_fd) != 0) {
+        m_failed = true;
+    }
+    m_fd = -1;
+}
+
+bool Emitter::Commit() {
+    ProfileScope scope("Emitter::Commit", m_fname);
+    ProfilerCount("bytes emitted", m_total);
+
+    Flush();
+
+    // the existing file must not have more content
+    char c;
+    const bool unchanged = (m_old_fd >= 0 && read(m_old_fd, &c, 1) == 0);
+
+    Close();
+
+    if (m_failed || unchanged) {
+        unlink(m_tmp_fname.c_str());
+        return !m_failed;
+    }
+
+    if (rename(m_tmp_fname.c_str(), m_fname.c_str()) != 0) {
+        cerr << "rename [" << m_tmp_fname << "] to [" << m_fname << "] failed: "
+             << strerror(errno) << endl;
+        unlink(m_tmp_fname.c_str());
+        return false;
+    }
+
+    return true;
+}
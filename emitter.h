@@ -0,0 +1,54 @@
+#ifndef __OMAKE_EMITTER_H__
+#define __OMAKE_EMITTER_H__
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+/*
+  writes generated content through a fixed-size buffer into a temp file, which
+  replaces the target file in Commit(). content is compared with the existing
+  file chunk by chunk, so that an unchanged file keeps its mtime.
+*/
+class Emitter final {
+public:
+    Emitter();
+    ~Emitter();
+
+    bool Open(const std::string& fname);
+    bool Commit();
+
+    /* the temp file written by Open(fname) */
+    static std::string TempFileName(const std::string& fname);
+
+    Emitter& operator<<(const std::string& s) {
+        Append(s.data(), s.size());
+        return *this;
+    }
+    Emitter& operator<<(const char* s) {
+        Append(s, strlen(s));
+        return *this;
+    }
+
+private:
+    void Append(const char* data, size_t len);
+    void Flush();
+    void Close();
+
+private:
+    std::string m_fname;
+    std::string m_tmp_fname;
+    int m_fd;
+    int m_old_fd; // -1 if the existing file differs or does not exist
+    bool m_failed;
+    size_t m_total;
+    std::vector<char> m_buf;
+    size_t m_buf_size;
+    std::vector<char> m_cmp_buf;
+
+private:
+    Emitter(const Emitter&);
+    Emitter& operator=(const Emitter&);
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "fs_cache.h"
+#include "profiler.h"
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+using namespace std;
+
+static mutex g_lock;
+static unordered_map<string, bool> g_exists;
+static unordered_map<string, unique_ptr<FsDirListing>> g_listings; // pointers are handed out
+
+bool FsExists(const string& path) {
+    {
+        lock_guard<mutex> guard(g_lock);
+        auto ref = g_exists.find(path);
+        if (ref != g_exists.end()) {
+            ProfilerCount("fs cache hits", 1);
+            return ref->second;
+        }
+    }
+
+    ProfilerCount("fs cache misses", 1);
+    const bool exists = (access(path.c_str(), F_OK) == 0);
+
+    lock_guard<mutex> guard(g_lock);
+    g_exists.insert(make_pair(path, exists));
+    return exists;
+}
+
+static void ReadDir(const string& dir, FsDirListing* listing) {
+    listing->err = 0;
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        listing->err = errno;
+        return;
+    }
+    DIR* dirp = fdopendir(fd);
+    if (!dirp) {
+        listing->err = errno;
+        close(fd);
+        return;
+    }
+
+    struct dirent* dentry;
+    while ((dentry = readdir(dirp))) {
+        const char* name = dentry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        FsDirEntry entry;
+        entry.name = name;
+        // d_type saves a stat() for most entries
+        entry.is_dir = (dentry->d_type == DT_DIR);
+        entry.is_file = (dentry->d_type == DT_REG);
+        entry.is_link = (dentry->d_type == DT_LNK);
+        if (entry.is_link || dentry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(fd, name, &st, 0) == 0) {
+                entry.is_dir = S_ISDIR(st.st_mode);
+                entry.is_file = S_ISREG(st.st_mode);
+            }
+        }
+        listing->entries.push_back(std::move(entry));
+    }
+    closedir(dirp);
+
+    sort(listing->entries.begin(), listing->entries.end(),
+         [] (const FsDirEntry& a, const FsDirEntry& b) -> bool {
+             return (a.name < b.name);
+         });
+}
+
+const FsDirListing* FsListDir(const string& dir) {
+    {
+        lock_guard<mutex> guard(g_lock);
+        auto ref = g_listings.find(dir);
+        if (ref != g_listings.end()) {
+            ProfilerCount("fs cache hits", 1);
+            return ref->second.get();
+        }
+    }
+
+    ProfilerCount("fs cache misses", 1);
+    unique_ptr<FsDirListing> listing(new FsDirListing());
+    ReadDir(dir, listing.get());
+
+    // another thread may have read it in the meantime
+    lock_guard<mutex> guard(g_lock);
+    auto ret_pair = g_listings.insert(make_pair(dir, std::move(listing)));
+    return ret_pair.first->second.get();
+}
+
+void FsCacheClear() {
+    lock_guard<mutex> guard(g_lock);
+    g_exists.clear();
+    g_listings.clear();
+}
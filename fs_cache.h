@@ -0,0 +1,28 @@
+#ifndef __OMAKE_FS_CACHE_H__
+#define __OMAKE_FS_CACHE_H__
+
+#include <string>
+#include <vector>
+
+struct FsDirEntry final {
+    std::string name;
+    bool is_dir; // symlinks are resolved
+    bool is_file;
+    bool is_link;
+};
+
+struct FsDirListing final {
+    int err; // errno of opening the dir, 0 if succeeded
+    std::vector<FsDirEntry> entries; // sorted by name, without "." and ".."
+};
+
+/*
+  filesystem metadata is memoized for the whole run so that the same paths are
+  not probed again and again. thread-safe. hits and misses are traced as counters.
+*/
+bool FsExists(const std::string& path);
+const FsDirListing* FsListDir(const std::string& dir);
+/* forgets everything. pointers returned by FsListDir() become invalid. */
+void FsCacheClear();
+
+#endif
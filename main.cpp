@@ -1,13 +1,30 @@
 #include "project.h"
 #include "target.h"
 #include "utils.h"
+#include "profiler.h"
+#include "stats.h"
+#include "fs_cache.h"
+#include "watch.h"
+#include "emitter.h"
 #include <string>
 #include <iostream>
+#include <cstring>
 using namespace std;
 using namespace luacpp;
 
+#define BACKEND_MAKE "make"
+#define BACKEND_NINJA "ninja"
+
+static const char* OutputFile(const string& backend) {
+    return (backend == BACKEND_NINJA) ? "build.ninja" : "Makefile";
+}
+
 class OMakeHelper final : public LuaFunctionHelper {
 public:
+    OMakeHelper(const string& backend, bool debug, const string& lto, ResidentState* state,
+                vector<pair<string, string>>* inputs)
+        : m_backend(backend), m_debug(debug), m_lto(lto), m_state(state), m_inputs(inputs) {}
+
     bool BeforeProcess(int nresults) override {
         if (nresults != 1) {
             cerr << "result num != 1" << endl;
@@ -18,21 +35,160 @@ public:
 
     bool Process(int, const LuaObject& obj) override {
         auto project = obj.ToUserData().Get<Project>();
-        return project->GenerateMakefile("Makefile");
+        project->SetResidentState(m_state);
+        bool ok;
+        if (m_backend == BACKEND_NINJA) {
+            ok = project->GenerateNinja(OutputFile(m_backend), m_debug, m_lto);
+        } else {
+            ok = project->GenerateMakefile(OutputFile(m_backend));
+        }
+        if (m_inputs) {
+            project->ForEachGeneratorInput([this] (const string& input, const string& owner) -> void {
+                m_inputs->push_back(make_pair(input, owner));
+            });
+        }
+        return ok;
     }
 
     void AfterProcess() override {}
+
+private:
+    const string m_backend;
+    // ninja has no conditionals, so these are decided here
+    const bool m_debug;
+    const string m_lto;
+    ResidentState* m_state; // optional
+    vector<pair<string, string>>* m_inputs; // files and dirs to be watched with owners, optional
 };
 
-int main(void) {
-    LuaState l;
-    InitLuaEnv(&l);
+static void PrintUsage(const char* prog) {
+    cerr << "usage: " << prog << " [--backend=" BACKEND_MAKE "|" BACKEND_NINJA "] [debug=y] [lto=y|thin] [--trace=file.json] [--watch]" << endl
+         << "       " << prog << " report [stats log, default " OMAKE_STATS_LOG_FILE "]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    // used by generated Makefiles with `make stats=y`
+    if (argc > 1 && strcmp(argv[1], "record") == 0) {
+        if (argc < 8 || strcmp(argv[6], "--") != 0) {
+            cerr << "usage: " << argv[0] << " record <log> <target> <group> <output> -- <command>" << endl;
+            return 127;
+        }
+        return RecordCommand(argv[2], argv[3], argv[4], argv[5], argv + 7);
+    }
+    if (argc > 1 && strcmp(argv[1], "report") == 0) {
+        if (argc > 3) {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+        return ReportStats((argc == 3) ? argv[2] : OMAKE_STATS_LOG_FILE);
+    }
+
+    string backend = BACKEND_MAKE;
+    bool debug = false;
+    string lto;
+    string trace_file;
+    bool watch = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--backend=", 10) == 0) {
+            backend = argv[i] + 10;
+            if (backend != BACKEND_MAKE && backend != BACKEND_NINJA) {
+                cerr << "unknown backend [" << backend << "]" << endl;
+                PrintUsage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "debug=y") == 0) {
+            debug = true;
+        } else if (strcmp(argv[i], "lto=y") == 0 || strcmp(argv[i], "lto=thin") == 0) {
+            lto = argv[i] + 4;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_file = argv[i] + 8;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!trace_file.empty()) {
+        ProfilerEnableTrace(true);
+    }
+
+    Watcher watcher;
+    if (watch) {
+        if (!watcher.Init()) {
+            return -1;
+        }
+        // written by every run. the top dir is often watched as a whole because of wildcards.
+        const string output = OutputFile(backend);
+        watcher.Ignore(output);
+        watcher.Ignore(Emitter::TempFileName(output));
+        watcher.Ignore(".omake"); // dep cache, stats and pgo data
+    }
+
+    /*
+      in watch mode sub-projects and the dep tree are kept in `state`. after a change only
+      the sub-projects owning the changed inputs are evaluated again. the top omake.lua is
+      evaluated on every run, as its targets live in its own lua state. inputs are watched
+      before they are evaluated, so changes made meanwhile lead to another run.
+    */
+    ResidentState state;
+    // still watched after errors so that fixing omake.lua triggers a new run
+    const pair<string, string> top_input("omake.lua", string());
+    vector<pair<string, string>> inputs(1, top_input);
+    while (true) {
+        ProfilerReset(); // traces cover the latest run only
+
+        if (watch) {
+            watcher.Watch(inputs, nullptr); // dirs replaced since the last run get new watches
+        }
+
+        inputs.assign(1, top_input);
+        {
+            ProfileScope scope("omake");
+
+            LuaState l;
+            InitLuaEnv(&l);
+
+            string errmsg;
+            OMakeHelper helper(backend, debug, lto, watch ? &state : nullptr,
+                               watch ? &inputs : nullptr);
+            bool ok = l.DoFile("omake.lua", &errmsg, &helper);
+            if (!ok) {
+                cerr << "DoFile error: " << errmsg << endl;
+            }
+        }
+
+        if (!trace_file.empty()) {
+            ProfilerWriteTrace(trace_file);
+        }
+
+        if (!watch) {
+            break;
+        }
+
+        // dirs found in this run may have changed before they were watched
+        set<string> owners;
+        if (watcher.Watch(inputs, &owners) > 0) {
+            for (auto& dir : owners) {
+                if (!dir.empty()) {
+                    state.Recheck(dir);
+                }
+            }
+        } else {
+            if (!watcher.Wait(&owners)) {
+                return -1;
+            }
+            for (auto& dir : owners) {
+                if (!dir.empty()) {
+                    state.Invalidate(dir);
+                }
+            }
+            cerr << "omake: changes detected, regenerating" << endl;
+        }
 
-    string errmsg;
-    OMakeHelper helper;
-    bool ok = l.DoFile("omake.lua", &errmsg, &helper);
-    if (!ok) {
-        cerr << "DoFile error: " << errmsg << endl;
+        FsCacheClear();
     }
 
     return 0;
@@ -3,8 +3,9 @@ project = Project()
 project:CreateBinary("omake"):AddDependencies(
     project:CreateDependency()
         :AddSourceFiles("*.cpp")
-        :AddFlags({"-Wall", "-Werror", "-Wextra"})
+        :AddFlags({"-std=c++17", "-Wall", "-Werror", "-Wextra"})
         :AddStaticLibraries("../lua-cpp", "luacpp_static")
-        :AddStaticLibraries("../cpputils", "cpputils_static"))
+        :AddStaticLibraries("../cpputils", "cpputils_static")
+        :AddSysLibraries("pthread"))
 
 return project
@@ -0,0 +1,194 @@
+#include "profiler.h"
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdio> // snprintf()
+#include <cstring> // strerror()
+#include <cerrno>
+#include <unistd.h> // getpid()
+using namespace std;
+
+struct PhaseStat final {
+    PhaseStat() : total_ns(0), count(0) {}
+    uint64_t total_ns;
+    uint64_t count;
+};
+
+/* a span if `is_counter` is false, otherwise `value` of a counter at `begin_ns` */
+struct TraceEvent final {
+    const char* name;
+    bool is_counter;
+    int tid;
+    uint64_t begin_ns;
+    uint64_t dur_ns;
+    int64_t value;
+    string detail;
+};
+
+static atomic<bool> g_enabled(false);
+static atomic<bool> g_trace_enabled(false);
+static atomic<int> g_thread_counter(0);
+static mutex g_lock; // phases may be recorded by several threads
+static map<string, PhaseStat> g_phases;
+static map<string, int64_t> g_counters;
+static vector<TraceEvent> g_events;
+
+static inline uint64_t NowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* small sequential ids read better than pthread ids in trace viewers */
+static int CurrentTid() {
+    static thread_local int tid = -1;
+    if (tid < 0) {
+        tid = g_thread_counter.fetch_add(1);
+    }
+    return tid;
+}
+
+void ProfilerEnable(bool enabled) {
+    g_enabled = enabled;
+}
+
+void ProfilerEnableTrace(bool enabled) {
+    g_trace_enabled = enabled;
+    if (enabled) {
+        g_enabled = true;
+    }
+}
+
+void ProfilerReset() {
+    lock_guard<mutex> guard(g_lock);
+    g_phases.clear();
+    g_counters.clear();
+    g_events.clear();
+}
+
+void ProfilerForEachPhase(const function<void (const char*, uint64_t, uint64_t)>& f) {
+    lock_guard<mutex> guard(g_lock);
+    for (auto& iter : g_phases) {
+        f(iter.first.c_str(), iter.second.total_ns, iter.second.count);
+    }
+}
+
+void ProfilerCount(const char* name, int64_t delta) {
+    if (!g_trace_enabled) {
+        return;
+    }
+
+    TraceEvent ev;
+    ev.name = name;
+    ev.is_counter = true;
+    ev.tid = CurrentTid();
+    ev.begin_ns = NowNs();
+    ev.dur_ns = 0;
+
+    lock_guard<mutex> guard(g_lock);
+    int64_t* value = &g_counters[name];
+    *value += delta;
+    ev.value = *value;
+    g_events.push_back(std::move(ev));
+}
+
+static string JsonEscape(const string& s) {
+    string res;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            res.push_back('\\');
+            res.push_back(c);
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+            res += buf;
+        } else {
+            res.push_back(c);
+        }
+    }
+    return res;
+}
+
+bool ProfilerWriteTrace(const string& fname) {
+    ofstream ofs(fname.c_str(), ios_base::out | ios_base::trunc);
+    if (!ofs.is_open()) {
+        cerr << "open trace file [" << fname << "] failed: " << strerror(errno) << endl;
+        return false;
+    }
+
+    lock_guard<mutex> guard(g_lock);
+
+    // spans are appended when they end, so the first event is not always the earliest one
+    uint64_t min_ns = UINT64_MAX;
+    for (auto& ev : g_events) {
+        if (ev.begin_ns < min_ns) {
+            min_ns = ev.begin_ns;
+        }
+    }
+
+    const int pid = getpid();
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (auto& ev : g_events) {
+        // timestamps are in microseconds
+        const double ts = (ev.begin_ns - min_ns) / 1000.0;
+        ofs << (first ? "\n" : ",\n") << "{\"name\":\"" << ev.name << "\",\"cat\":\"omake\",\"pid\":"
+            << pid << ",\"tid\":" << ev.tid << ",\"ts\":" << ts;
+        if (ev.is_counter) {
+            ofs << ",\"ph\":\"C\",\"args\":{\"value\":" << ev.value << "}}";
+        } else {
+            ofs << ",\"ph\":\"X\",\"dur\":" << ev.dur_ns / 1000.0;
+            if (!ev.detail.empty()) {
+                ofs << ",\"args\":{\"detail\":\"" << JsonEscape(ev.detail) << "\"}";
+            }
+            ofs << "}";
+        }
+        first = false;
+    }
+    ofs << "\n]}\n";
+
+    ofs.close();
+    if (ofs.fail()) {
+        cerr << "write trace file [" << fname << "] failed." << endl;
+        return false;
+    }
+    return true;
+}
+
+ProfileScope::ProfileScope(const char* name, const string& detail)
+    : m_name(g_enabled ? name : nullptr), m_begin_ns(m_name ? NowNs() : 0) {
+    if (m_name && g_trace_enabled) {
+        m_detail = detail;
+    }
+}
+
+ProfileScope::~ProfileScope() {
+    if (!m_name) {
+        return;
+    }
+
+    const uint64_t end_ns = NowNs();
+    const uint64_t cost = end_ns - m_begin_ns;
+
+    TraceEvent ev;
+    if (g_trace_enabled) {
+        ev.name = m_name;
+        ev.is_counter = false;
+        ev.tid = CurrentTid();
+        ev.begin_ns = m_begin_ns;
+        ev.dur_ns = cost;
+        ev.value = 0;
+        ev.detail = std::move(m_detail);
+    }
+
+    lock_guard<mutex> guard(g_lock);
+    PhaseStat* stat = &g_phases[m_name];
+    stat->total_ns += cost;
+    ++stat->count;
+    if (g_trace_enabled) {
+        g_events.push_back(std::move(ev));
+    }
+}
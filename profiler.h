@@ -0,0 +1,36 @@
+#ifndef __OMAKE_PROFILER_H__
+#define __OMAKE_PROFILER_H__
+
+#include <stdint.h>
+#include <string>
+#include <functional>
+
+/* accumulates wall time of named phases. disabled by default. */
+void ProfilerEnable(bool enabled);
+/* also records every span and counter update for ProfilerWriteTrace() */
+void ProfilerEnableTrace(bool enabled);
+void ProfilerReset();
+void ProfilerForEachPhase(const std::function<void (const char* name, uint64_t total_ns,
+                                                    uint64_t count)>& f);
+/* `name` must be a string literal */
+void ProfilerCount(const char* name, int64_t delta);
+/* writes recorded events in chrome trace event format */
+bool ProfilerWriteTrace(const std::string& fname);
+
+class ProfileScope final {
+public:
+    /* `name` must be a string literal. `detail` is shown in traces only. */
+    ProfileScope(const char* name, const std::string& detail = std::string());
+    ~ProfileScope();
+
+private:
+    const char* m_name;
+    uint64_t m_begin_ns;
+    std::string m_detail;
+
+private:
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+};
+
+#endif
@@ -1,18 +1,35 @@
 #include "project.h"
 #include "utils.h"
+#include "profiler.h"
+#include "stats.h"
+#include "emitter.h"
+#include "fs_cache.h"
 #include "common.h"
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
-#include <unistd.h> // access()
-#include <cstring> // strerror()
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <unistd.h> // getcwd()
 using namespace std;
 
 #include "lua-cpp/luacpp.h"
 using namespace luacpp;
 
+#include "cpputils/text_utils.h"
+using namespace outils;
+
+// dir of the omake.lua being evaluated by this thread. see ProcessOMakeProject().
+static thread_local const string* g_base_dir = nullptr;
+
+Project::Project()
+    : m_dep_counter(0), m_unity_batch_size(0), m_non_recursive(false), m_thin_archive(false), m_base_dir(g_base_dir ? *g_base_dir : string(".")),
+      m_resident(nullptr) {}
+
 Target* Project::CreateBinary(const char* name) {
     auto ret_pair = m_targets.insert(make_pair(name, nullptr));
     if (!ret_pair.second) {
@@ -49,7 +66,7 @@ Target* Project::CreateSharedLibrary(const char* name) {
 Dependency* Project::CreateDependency() {
     const string dep_prefix = "omake_dep_";
 
-    auto d = new Dependency(dep_prefix + std::to_string(m_dep_counter));
+    auto d = new Dependency(dep_prefix + std::to_string(m_dep_counter), m_base_dir);
     ++m_dep_counter;
     return d;
 }
@@ -63,49 +80,56 @@ Target* Project::FindTarget(const string& name) const {
     return ref->second;
 }
 
-static bool WriteFile(const string& fname, const string& content) {
-    ofstream ofs;
-    ofs.open(fname, ios_base::out | ios_base::trunc);
-    if (!ofs.is_open()) {
-        return false;
+void Project::ForEachTarget(const function<void (const Target*)>& f) const {
+    for (auto iter : m_targets) {
+        f(iter.second);
     }
+}
 
-    ofs.write(content.data(), content.size());
-    ofs.close();
-    return true;
+void Project::ForEachGeneratorInput(const function<void (const string&, const string&)>& f) const {
+    for (auto& iter : m_generator_inputs) {
+        for (auto& owner : iter.second) {
+            f(iter.first, owner);
+        }
+    }
+}
+
+/* keeps the mtime of `fname` if its content is not changed */
+static bool WriteFileIfChanged(const string& fname, const string& content) {
+    Emitter out;
+    if (!out.Open(fname)) {
+        return false;
+    }
+    out << content;
+    return out.Commit();
 }
 
+/* make variable of the dir of linked files, relative to the project dir. empty by default. */
+#define MAKE_OUT_DIR "$(omake_outdir)"
+
 static inline bool IsSysLib(const LibInfo& lib) {
     return lib.path.empty();
 }
 
 static inline bool IsThirdPartyLib(const LibInfo& lib) {
-    return (access((lib.path + "/omake.lua").c_str(), F_OK) != 0);
+    return !FsExists(lib.path + "/omake.lua");
 }
 
 static inline bool IsLocalLib(const LibInfo& lib) {
     return (lib.path == ".");
 }
 
-struct DepTreeNode {
-    DepTreeNode(const string& _path, const string& _name, int _lib_type)
-        : lib(_path, _name, _lib_type) {}
-    DepTreeNode(const LibInfo& _lib) : lib(_lib) {}
-
-    LibInfo lib;
-    set<string> inc_dirs;
-    vector<const DepTreeNode*> deps; // keep order of insertion
-};
-
-static bool InsertDepNode(const DepTreeNode* dep, vector<const DepTreeNode*>* dep_list) {
-    for (auto ddd : *dep_list) {
-        if (ddd == dep) {
-            return false;
-        }
+/*
+  all deps of a parent are inserted in one go, so `last_parent[dep]` telling which parent `dep`
+  was inserted into last is enough to drop duplicated edges.
+*/
+static void InsertDepNode(int dep, int parent, vector<int>* last_parent, DepTree* dep_tree) {
+    if ((*last_parent)[dep] == parent) {
+        return;
     }
 
-    dep_list->push_back(dep);
-    return true;
+    (*last_parent)[dep] = parent;
+    dep_tree->nodes[parent].deps.push_back(dep);
 }
 
 class ProjectHelper final : public LuaFunctionHelper {
@@ -126,114 +150,377 @@ private:
     function<bool (int, const LuaObject&)> m_proc;
 };
 
+/* never changes the cwd so that projects can be evaluated concurrently */
 static bool ProcessOMakeProject(const string& dir, ProjectHelper* helper) {
-#define MAX_PATH_LEN 4096
+    ProfileScope scope("ProcessOMakeProject", dir);
+    ProfilerCount("omake.lua evaluated", 1);
+
     LuaState l;
     InitLuaEnv(&l);
 
-    char cur_path[MAX_PATH_LEN];
-    if (!getcwd(cur_path, MAX_PATH_LEN)) {
-        cerr << "path too long" << endl;
-        return false;
-    }
-
-    if (chdir(dir.c_str()) != 0) {
-        cerr << "chdir to [" << dir << "] failed: "
-             << strerror(errno) << endl;
-        return false;
-    }
+    g_base_dir = &dir;
 
     string errmsg;
-    bool ok = l.DoFile("omake.lua", &errmsg, helper);
+    bool ok = l.DoFile((dir + "/omake.lua").c_str(), &errmsg, helper);
     if (!ok) {
         cerr << "Preprocessing dependency [" << dir << "/omake.lua] failed: "
              << errmsg << endl;
     }
 
-    if (chdir(cur_path) != 0) {
-        cerr << "chdir to [" << cur_path << "] failed: "
-             << strerror(errno) << endl;
-        return false;
-    }
-
+    g_base_dir = nullptr;
     return ok;
-#undef MAX_PATH_LEN
 }
 
-static void GenerateDepTree(const Target* target,
-                            unordered_map<LibInfo, DepTreeNode, LibInfoHash>* dep_tree) {
-    list<DepTreeNode*> q;
+static bool EvalOMakeProject(const string& dir, CachedProject* proj) {
+    const string omake_file = dir + "/omake.lua";
+
+    auto before_proc = [&omake_file] (int nresults) -> bool {
+        if (nresults != 1) {
+            cerr << "omake [" << omake_file << "] result num != 1" << endl;
+            return false;
+        }
+        return true;
+    };
+
+    auto proc = [&proj] (int, const LuaObject& obj) -> bool {
+        auto project = obj.ToUserData().Get<Project>();
+        project->ForEachTarget([&proj, &project] (const Target* target) {
+            CachedTarget* ct = &proj->targets[target->GetName()];
+            ct->type = target->GetType();
+            target->ForEachDependency([&proj, &project, &ct] (const Dependency* dep) {
+                ct->deps.push_back(CachedDependency());
+                CachedDependency* cd = &ct->deps.back();
+                cd->name = dep->GetName();
+                cd->pch = dep->GetPrecompiledHeader();
+                cd->unity_batch_size = (dep->GetUnityBatchSize() < 0)
+                    ? project->GetUnityBatchSize() : dep->GetUnityBatchSize();
+                dep->ForEachFlag([&cd] (const string& flag) {
+                    cd->flags.push_back(flag);
+                });
+                dep->ForEachCSource([&cd] (const string& src) {
+                    cd->c_sources.push_back(src);
+                });
+                dep->ForEachCppSource([&cd] (const string& src) {
+                    cd->cpp_sources.push_back(src);
+                });
+                dep->ForEachIncDir([&cd] (const string& inc) {
+                    cd->inc_dirs.push_back(inc);
+                });
+                dep->ForEachLibrary([&cd] (const LibInfo& lib) {
+                    cd->libs.push_back(lib);
+                });
+                dep->ForEachUnityExclude([&cd] (const string& src) {
+                    cd->unity_excludes.push_back(src);
+                });
+                dep->ForEachGlobDir([&proj] (const string& gdir) {
+                    proj->glob_dirs.insert(gdir);
+                });
+            });
+        });
+        return true;
+    };
+
+    ProjectHelper helper(before_proc, proc);
+    return ProcessOMakeProject(dir, &helper);
+}
+
+/* evaluates omake.lua in `dirs` on a thread pool, each with its own LuaState */
+static void EvalOMakeProjects(const vector<string>& dirs, vector<CachedProject>* projs,
+                              vector<char>* succ) {
+    ProfileScope scope("EvalOMakeProjects");
 
-    auto handle_lib = [&q, &dep_tree] (const LibInfo& lib, bool is_third_party) -> DepTreeNode* {
-        auto ret_pair = dep_tree->insert(make_pair(lib, DepTreeNode(lib)));
-        auto node = &ret_pair.first->second;
+    projs->resize(dirs.size());
+    succ->assign(dirs.size(), 0);
 
-        if (ret_pair.second) {
-            if ((!IsSysLib(lib)) && (!is_third_party)) {
-                q.push_back(node);
+    atomic<size_t> next(0);
+    auto worker = [&dirs, &projs, &succ, &next] () {
+        while (true) {
+            const size_t i = next.fetch_add(1);
+            if (i >= dirs.size()) {
+                break;
             }
+            (*succ)[i] = EvalOMakeProject(dirs[i], &(*projs)[i]);
         }
+    };
+
+    size_t nr_thread = thread::hardware_concurrency();
+    if (nr_thread > dirs.size()) {
+        nr_thread = dirs.size();
+    }
+
+    vector<thread> pool;
+    for (size_t i = 1; i < nr_thread; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+/* nodes are referred to by ids because `nodes` may be reallocated while the tree grows */
+static void GenerateDepTree(const Target* target, DepCache* cache, DepTree* dep_tree) {
+    list<int> q;
+    vector<int> last_parent;
 
-        return node;
+    auto handle_lib = [&q, &last_parent, &dep_tree] (const LibInfo& lib) -> int {
+        auto ret_pair = dep_tree->Intern(lib);
+        if (ret_pair.second) {
+            last_parent.push_back(-1);
+            if ((!IsSysLib(lib)) && (!IsThirdPartyLib(lib))) {
+                q.push_back(ret_pair.first);
+            }
+        }
+        return ret_pair.first;
     };
 
+    last_parent.assign(dep_tree->nodes.size(), -1);
     target->ForEachDependency([&handle_lib] (const Dependency* dep) {
         dep->ForEachLibrary([&handle_lib] (const LibInfo& lib) {
-            handle_lib(lib, IsThirdPartyLib(lib));
+            handle_lib(lib);
         });
     });
 
+    // one level of the tree at a time: projects in the same level are independent
     while (!q.empty()) {
-        auto parent = q.front();
-        q.pop_front();
+        vector<string> dirs;
+        unordered_set<string> dir_dedup;
+        for (auto id : q) {
+            const string& dir = dep_tree->nodes[id].lib.path;
+            if (dir_dedup.insert(dir).second && !cache->Find(dir)) {
+                dirs.push_back(dir);
+            }
+        }
+
+        vector<CachedProject> projs;
+        vector<char> succ;
+        EvalOMakeProjects(dirs, &projs, &succ);
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            if (succ[i]) {
+                cache->Update(dirs[i], std::move(projs[i]));
+            }
+        }
 
-        const string omake_file = parent->lib.path + "/omake.lua";
+        list<int> level;
+        level.swap(q);
 
-        auto before_proc = [&omake_file] (int nresults) -> bool {
-            if (nresults != 1) {
-                cerr << "omake [" << omake_file << "] result num != 1" << endl;
-                return false;
+        for (auto parent : level) {
+            const LibInfo parent_lib = dep_tree->nodes[parent].lib;
+            auto proj = cache->Find(parent_lib.path);
+            if (!proj) {
+                continue;
             }
-            return true;
-        };
 
-        auto proc = [&parent, &handle_lib] (int, const LuaObject& obj) -> bool {
-            auto project = obj.ToUserData().Get<Project>();
-            auto target = project->FindTarget(parent->lib.name);
-            if (!target) {
-                return true;
+            auto ref = proj->targets.find(parent_lib.name);
+            if (ref == proj->targets.end()) {
+                continue;
             }
 
-            target->ForEachDependency([&parent, &handle_lib] (const Dependency* dep) {
-                dep->ForEachLibrary([&parent, &handle_lib] (const LibInfo& lib) {
+            // `omake --watch` builds the tree again with the same paths, hence the memo
+            for (auto& dep : ref->second.deps) {
+                for (auto& lib : dep.libs) {
                     string new_path;
-                    bool is_third_party = IsThirdPartyLib(lib);
                     if ((!lib.path.empty()) && lib.path[0] != '/') {
-                        new_path = RemoveDotAndDotDot(parent->lib.path + "/" + lib.path);
+                        new_path = RemoveDotAndDotDotMemo(parent_lib.path + "/" + lib.path);
                     } else {
                         new_path = lib.path;
                     }
 
-                    auto node = handle_lib(LibInfo(new_path, lib.name, lib.type), is_third_party);
-                    InsertDepNode(node, &parent->deps);
-                });
+                    const int id = handle_lib(LibInfo(new_path, lib.name, lib.type));
+                    InsertDepNode(id, parent, &last_parent, dep_tree);
+                }
 
-                dep->ForEachIncDir([&parent] (const string& inc) {
+                auto& inc_dirs = dep_tree->nodes[parent].inc_dirs;
+                for (auto& inc : dep.inc_dirs) {
                     if (inc[0] == '/') {
-                        parent->inc_dirs.insert(inc);
+                        inc_dirs.insert(inc);
                     } else {
-                        parent->inc_dirs.insert(
-                            RemoveDotAndDotDot(parent->lib.path + "/" + inc));
+                        inc_dirs.insert(RemoveDotAndDotDotMemo(parent_lib.path + "/" + inc));
                     }
-                });
+                }
+            }
+        }
+    }
+}
+
+static void GenerateDepTrees(const map<string, Target*>& targets, DepCache* cache,
+                             DepTree* dep_tree) {
+    ProfileScope scope("GenerateDepTree");
+    for (auto iter : targets) {
+        GenerateDepTree(iter.second, cache, dep_tree);
+    }
+}
+
+/* `state->dep_tree` of `targets`, built again only if it may be out of date */
+static void UpdateDepTree(const map<string, Target*>& targets, ResidentState* state) {
+    if (!state->loaded) {
+        state->cache.Load(OMAKE_DEP_CACHE_FILE);
+        state->loaded = true;
+    }
+
+    vector<LibInfo> roots;
+    for (auto iter : targets) {
+        iter.second->ForEachDependency([&roots] (const Dependency* dep) {
+            dep->ForEachLibrary([&roots] (const LibInfo& lib) {
+                roots.push_back(lib);
+            });
+        });
+    }
+    if (state->tree_valid && roots == state->roots) {
+        return;
+    }
+
+    state->dep_tree = DepTree();
+    GenerateDepTrees(targets, &state->cache, &state->dep_tree);
+    state->roots = std::move(roots);
+    state->tree_valid = true;
+}
+
+/*
+  omake.lua files evaluated and dirs scanned by wildcards, relative to the cwd. each of them
+  is mapped to the dirs of the sub-projects using it, and to "" for the current project.
+*/
+static void CollectGeneratorInputs(const map<string, Target*>& targets, const string& base_dir,
+                                   const DepTree& dep_tree, DepCache* cache,
+                                   map<string, set<string>>* inputs) {
+    auto join = [] (const string& dir, const string& path) -> string {
+        if (dir == "." || path[0] == '/') {
+            return path;
+        }
+        return RemoveDotAndDotDotMemo(dir + "/" + path);
+    };
+
+    inputs->clear();
+    (*inputs)[join(base_dir, "omake.lua")].insert(string());
+    for (auto iter : targets) {
+        iter.second->ForEachDependency([&join, &base_dir, inputs] (const Dependency* dep) {
+            dep->ForEachGlobDir([&join, &base_dir, inputs] (const string& gdir) {
+                (*inputs)[join(base_dir, gdir)].insert(string());
             });
+        });
+    }
 
+    for (auto& node : dep_tree.nodes) {
+        const string& dir = node.lib.path;
+        if (IsSysLib(node.lib) || IsThirdPartyLib(node.lib)) {
+            continue;
+        }
+        // watched even if it failed to evaluate, so that fixing it leads to a new run
+        (*inputs)[join(dir, "omake.lua")].insert(dir);
+        auto proj = cache->Find(dir);
+        if (!proj) {
+            continue;
+        }
+        for (auto& gdir : proj->glob_dirs) {
+            (*inputs)[join(dir, gdir)].insert(dir);
+        }
+    }
+}
+
+/* "../lua-cpp" -> "up_lua-cpp", used to qualify names of in-tree libraries */
+static string PathToName(const string& path) {
+    string name;
+    if (path[0] == '/') {
+        name = "_";
+    }
+
+    TextSplit(path.data(), path.size(), "/", 1, [&name] (const char* s, unsigned int l) -> bool {
+        if (l == 0 || (l == 1 && s[0] == '.')) {
             return true;
+        }
+        if (!name.empty() && name != "_") {
+            name += "_";
+        }
+        if (l == 2 && s[0] == '.' && s[1] == '.') {
+            name += "up";
+        } else {
+            name.append(s, l);
+        }
+        return true;
+    });
+
+    return name;
+}
+
+/*
+  in-tree libraries in `dep_tree` as targets of the current project, with
+  paths relative to the current dir, for non-recursive builds. fails if any
+  of them cannot be found.
+*/
+static bool CreateSubTargets(const DepTree& dep_tree,
+                             DepCache* cache, vector<unique_ptr<Dependency>>* deps,
+                             vector<unique_ptr<Target>>* targets) {
+    map<string, const LibInfo*> lib_list; // sorted to get a stable output
+    for (auto& node : dep_tree.nodes) {
+        const LibInfo& lib = node.lib;
+        if ((!IsLocalLib(lib)) && (!IsSysLib(lib)) && (!IsThirdPartyLib(lib))) {
+            lib_list.insert(make_pair(lib.path + "/" + lib.name + "." + std::to_string(lib.type),
+                                      &lib));
+        }
+    }
+
+    for (auto& iter : lib_list) {
+        const LibInfo& lib = *iter.second;
+
+        auto proj = cache->Find(lib.path);
+        if (!proj) {
+            cerr << "cannot build library [" << lib.name << "]: [" << lib.path
+                 << "/omake.lua] failed to evaluate" << endl;
+            return false;
+        }
+
+        auto ref = proj->targets.find(lib.name);
+        if (ref == proj->targets.end() || ref->second.type != lib.type) {
+            cerr << "cannot find library [" << lib.name << "] in ["
+                 << lib.path << "/omake.lua]" << endl;
+            return false;
+        }
+
+        auto qualify = [&lib] (const string& path) -> string {
+            return (path[0] == '/') ? path : RemoveDotAndDotDot(lib.path + "/" + path);
         };
 
-        ProjectHelper helper(before_proc, proc);
-        ProcessOMakeProject(parent->lib.path, &helper);
+        auto target = new Target(lib.name.c_str(), lib.type, lib.path);
+        targets->emplace_back(target);
+
+        const string prefix = PathToName(lib.path) + ".";
+        for (auto& cd : ref->second.deps) {
+            auto dep = new Dependency(prefix + cd.name, ".");
+            deps->emplace_back(dep);
+
+            for (auto& flag : cd.flags) {
+                dep->AddFlag(flag.c_str());
+            }
+            // already expanded. names like `foo[1].c` must not be taken as patterns.
+            for (auto& src : cd.c_sources) {
+                dep->AddSourceFile(qualify(src));
+            }
+            for (auto& src : cd.cpp_sources) {
+                dep->AddSourceFile(qualify(src));
+            }
+            for (auto& inc : cd.inc_dirs) {
+                dep->AddIncludeDirectory(qualify(inc).c_str());
+            }
+            for (auto& l : cd.libs) {
+                if (l.path.empty()) {
+                    dep->AddLibrary(nullptr, l.name.c_str(), l.type);
+                } else {
+                    dep->AddLibrary(qualify(l.path).c_str(), l.name.c_str(), l.type);
+                }
+            }
+            if (!cd.pch.empty()) {
+                dep->AddPrecompiledHeader(qualify(cd.pch).c_str());
+            }
+            dep->EnableUnityBuild(cd.unity_batch_size);
+            for (auto& src : cd.unity_excludes) {
+                dep->ExcludeFromUnityBuild(qualify(src).c_str());
+            }
+
+            target->AddDependency(dep);
+        }
     }
+
+    return true;
 }
 
 static string GetParentDir(const string& path) {
@@ -255,86 +542,80 @@ static string GetParentDir(const string& path) {
     return path;
 }
 
+/* in-degrees of nodes reachable from `target`, indexed by node id. 0 means unreachable. */
 static void CalcInDegree(const Target* target,
-                         const unordered_map<LibInfo, DepTreeNode, LibInfoHash>& dep_tree,
-                         unordered_map<const DepTreeNode*, int>* node2in) {
-    list<const DepTreeNode*> q;
-
-    target->ForEachDependency([&dep_tree, &q, &node2in] (const Dependency* dep) {
-        dep->ForEachLibrary([&dep_tree, &q, &node2in] (const LibInfo& lib) {
-            auto ref = dep_tree.find(lib);
-            auto ret_pair = node2in->insert(make_pair(&ref->second, 0));
-            ++ret_pair.first->second;
-            if (ret_pair.second) {
-                q.push_back(&ref->second);
-            }
+                         const DepTree& dep_tree,
+                         vector<int>* in_degree) {
+    ProfileScope scope("CalcInDegree");
+    in_degree->assign(dep_tree.nodes.size(), 0);
+    vector<int> q;
+
+    auto handle_node = [&q, &in_degree] (int id) {
+        if ((*in_degree)[id]++ == 0) {
+            q.push_back(id);
+        }
+    };
+
+    target->ForEachDependency([&dep_tree, &handle_node] (const Dependency* dep) {
+        dep->ForEachLibrary([&dep_tree, &handle_node] (const LibInfo& lib) {
+            handle_node(dep_tree.Id(lib));
         });
     });
 
-    while (!q.empty()) {
-        auto parent = q.front();
-        q.pop_front();
-
-        for (auto dep : parent->deps) {
-            auto ret_pair = node2in->insert(make_pair(dep, 0));
-            ++ret_pair.first->second;
-            if (ret_pair.second) {
-                q.push_back(dep);
-            }
+    for (size_t i = 0; i < q.size(); ++i) {
+        for (auto dep : dep_tree.nodes[q[i]].deps) {
+            handle_node(dep);
         }
     }
 }
 
 static void TopologicalSort(const Target* target,
-                            const unordered_map<LibInfo, DepTreeNode, LibInfoHash>& dep_tree,
-                            unordered_map<const DepTreeNode*, int>* node2in,
-                            vector<const DepTreeNode*>* res) {
-    list<const DepTreeNode*> q;
-
-    target->ForEachDependency([&dep_tree, &q, &node2in] (const Dependency* dep) {
-        dep->ForEachLibrary([&dep_tree, &q, &node2in] (const LibInfo& lib) {
-            auto dep_ref = dep_tree.find(lib);
-            auto ref = node2in->find(&dep_ref->second);
-            --ref->second;
-            if (ref->second == 0) {
-                q.push_back(ref->first);
-            }
+                            const DepTree& dep_tree,
+                            vector<int>* in_degree, vector<int>* res) {
+    ProfileScope scope("TopologicalSort");
+
+    // `res` is the queue as well
+    auto handle_node = [&res, &in_degree] (int id) {
+        if (--(*in_degree)[id] == 0) {
+            res->push_back(id);
+        }
+    };
+
+    target->ForEachDependency([&dep_tree, &handle_node] (const Dependency* dep) {
+        dep->ForEachLibrary([&dep_tree, &handle_node] (const LibInfo& lib) {
+            handle_node(dep_tree.Id(lib));
         });
     });
 
-    while (!q.empty()) {
-        auto parent = q.front();
-        q.pop_front();
-        res->push_back(parent);
-
-        for (auto dep : parent->deps) {
-            auto ref = node2in->find(dep);
-            --ref->second;
-            if (ref->second == 0) {
-                q.push_back(dep);
-            }
+    for (size_t i = 0; i < res->size(); ++i) {
+        for (auto dep : dep_tree.nodes[(*res)[i]].deps) {
+            handle_node(dep);
         }
     }
 }
 
+/* `outdir` is where in-tree libraries are put, relative to their project dirs */
 static string GenerateTargetDepLibs(const Target* target,
-                                    const unordered_map<LibInfo, DepTreeNode, LibInfoHash>& dep_tree,
-                                    unordered_map<const DepTreeNode*, int>* node2in) {
-    vector<const DepTreeNode*> dep_list;
-    TopologicalSort(target, dep_tree, node2in, &dep_list);
+                                    const DepTree& dep_tree,
+                                    const string& outdir, vector<int>* in_degree) {
+    vector<int> dep_list;
+    TopologicalSort(target, dep_tree, in_degree, &dep_list);
 
     string content;
     unordered_set<string> link_path_dedup;
 
-    for (auto dep : dep_list) {
-        const LibInfo& lib = dep->lib;
+    for (auto id : dep_list) {
+        const LibInfo& lib = dep_tree.nodes[id].lib;
+        // prebuilt libraries stay where they are
+        const bool prebuilt = (IsSysLib(lib) || IsThirdPartyLib(lib));
+        const string lib_dir = (prebuilt || outdir.empty()) ? lib.path : (lib.path + "/" + outdir);
         if (lib.type == OMAKE_TYPE_STATIC) {
-            content += " " + lib.path + "/lib" + lib.name + ".a";
+            content += " " + lib.path + "/" + (prebuilt ? string() : outdir) + "lib" + lib.name + ".a";
         } else if (lib.type == OMAKE_TYPE_SHARED) {
             if (!IsSysLib(lib)) {
-                auto ret_pair = link_path_dedup.insert(lib.path);
+                auto ret_pair = link_path_dedup.insert(lib_dir);
                 if (ret_pair.second) {
-                    content += " -L" + lib.path;
+                    content += " -L" + lib_dir;
                 }
             }
             content += " -l" + lib.name;
@@ -344,29 +625,48 @@ static string GenerateTargetDepLibs(const Target* target,
     return content;
 }
 
-static string GenerateObjects(const unordered_set<string>& obj_of_target) {
-    string content;
-    for (auto obj : obj_of_target) {
-        content += " " + obj;
+static void GenerateObjects(const unordered_set<string>& obj_of_target, Emitter* out) {
+    for (auto& obj : obj_of_target) {
+        *out << " " << obj;
     }
-    return content;
 }
 
-static string GeneratePhonyBuildInfo(const Target* target,
-                                     const unordered_map<LibInfo, DepTreeNode, LibInfoHash>& dep_tree,
-                                     const unordered_map<const DepTreeNode*, int>& node2in,
-                                     unordered_map<LibInfo, string, LibInfoHash>* node2label) {
+#define AR_STAMP_DIR ".omake/ar"
+
+/*
+  writes objects of a static library and how it is archived into a stamp file, which keeps
+  its mtime unless they change. returns the file name.
+*/
+static string WriteArchiveStamp(const string& var_prefix,
+                                const unordered_set<string>& obj_of_target, bool thin) {
+    const string fname = string(AR_STAMP_DIR) + "/" + var_prefix + ".objs";
+
+    set<string> objs(obj_of_target.begin(), obj_of_target.end()); // in a stable order
+    string content = thin ? "rcsDT\n" : "rcsD\n";
+    for (auto& obj : objs) {
+        content += obj + "\n";
+    }
+
+    if (!MakeDirs(AR_STAMP_DIR) || !WriteFileIfChanged(fname, content)) {
+        cerr << "write archive stamp [" << fname << "] failed." << endl;
+    }
+    return fname;
+}
+
+static void GeneratePhonyBuildInfo(const Target* target,
+                                   const DepTree& dep_tree,
+                                   const vector<int>& in_degree,
+                                   unordered_map<LibInfo, string, LibInfoHash>* node2label,
+                                   Emitter* out) {
     const string label_prefix = "omake_phony_";
 
-    string content;
     vector<const DepTreeNode*> node_list;
 
-    target->ForEachDependency([&dep_tree, &node2in, &node_list] (const Dependency* dep) {
-        dep->ForEachLibrary([&dep_tree, &node2in, &node_list] (const LibInfo& lib) {
-            auto dep_ref = dep_tree.find(lib);
-            auto ref = node2in.find(&dep_ref->second);
-            if (ref != node2in.end() && ref->second == 1) {
-                node_list.push_back(ref->first);
+    target->ForEachDependency([&dep_tree, &in_degree, &node_list] (const Dependency* dep) {
+        dep->ForEachLibrary([&dep_tree, &in_degree, &node_list] (const LibInfo& lib) {
+            const int id = dep_tree.Id(lib);
+            if (in_degree[id] == 1) {
+                node_list.push_back(&dep_tree.nodes[id]);
             }
         });
     });
@@ -378,23 +678,61 @@ static string GeneratePhonyBuildInfo(const Target* target,
                 make_pair(lib, label_prefix + std::to_string(node2label->size())));
             if (ret_pair.second) {
                 const string target_name = (lib.type == OMAKE_TYPE_STATIC)
-                    ? ("lib" + lib.name + ".a")
-                    : ("lib" + lib.name + ".so");
-                content += ".PHONY: " + ret_pair.first->second + "\n" +
-                    ret_pair.first->second + ":\n" +
-                    "\t$(MAKE) debug=$(debug) " + target_name +
-                    " -C " + lib.path + "\n\n";
+                    ? (MAKE_OUT_DIR "lib" + lib.name + ".a")
+                    : (MAKE_OUT_DIR "lib" + lib.name + ".so");
+                *out << ".PHONY: " << ret_pair.first->second << "\n"
+                     << ret_pair.first->second << ":\n"
+                     // empty values would override `launcher ?=` and `linker ?=` of sub-projects
+                     << "\t$(MAKE) debug=$(debug) lto=$(lto) pgo=$(pgo) builddir=$(builddir) stats=$(stats) "
+                     "$(if $(launcher),launcher=$(launcher)) $(if $(linker),linker=$(linker)) "
+                     << target_name << " -C " << lib.path << "\n\n";
             }
         }
     }
+}
 
-    return content;
+/*
+  absolute paths inside the current dir or its parent dir are converted to
+  relative ones so that compile commands don't depend on where the project
+  is checked out, which is what compiler caches like.
+*/
+static string ToRelativePath(const string& path) {
+    static const string cwd = [] () -> string {
+        char buf[4096];
+        return getcwd(buf, sizeof(buf)) ? string(buf) : string();
+    }();
+
+    if (path[0] != '/' || cwd.empty()) {
+        return path;
+    }
+
+    if (path == cwd) {
+        return ".";
+    }
+    if (path.size() > cwd.size() && path[cwd.size()] == '/' &&
+        path.compare(0, cwd.size(), cwd) == 0) {
+        return path.substr(cwd.size() + 1);
+    }
+
+    const int pos = FindParentDirPos(cwd.data(), cwd.size());
+    if (pos > 0) {
+        const string parent = cwd.substr(0, pos);
+        if (path == parent) {
+            return "..";
+        }
+        if (path.size() > parent.size() && path[parent.size()] == '/' &&
+            path.compare(0, parent.size(), parent) == 0) {
+            return ".." + path.substr(parent.size());
+        }
+    }
+
+    return path;
 }
 
 static string GenerateDepInc(const Dependency* dep,
-                             const unordered_map<LibInfo, DepTreeNode, LibInfoHash>& dep_tree) {
-    list<const DepTreeNode*> q;
-    unordered_set<const DepTreeNode*> lib_dedup;
+                             const DepTree& dep_tree) {
+    list<int> q;
+    vector<char> lib_dedup(dep_tree.nodes.size(), 0);
     unordered_set<string> inc_dedup;
 
     dep->ForEachIncDir([&inc_dedup] (const string& inc) {
@@ -406,15 +744,15 @@ static string GenerateDepInc(const Dependency* dep,
             return;
         }
 
-        auto ref = dep_tree.find(lib);
-        auto ret_pair = lib_dedup.insert(&ref->second);
-        if (ret_pair.second) {
-            q.push_back(&ref->second);
+        const int id = dep_tree.Id(lib);
+        if (!lib_dedup[id]) {
+            lib_dedup[id] = 1;
+            q.push_back(id);
         }
     });
 
     while (!q.empty()) {
-        auto parent = q.front();
+        auto parent = &dep_tree.nodes[q.front()];
         q.pop_front();
 
         inc_dedup.insert(GetParentDir(parent->lib.path));
@@ -423,24 +761,23 @@ static string GenerateDepInc(const Dependency* dep,
         }
 
         for (auto dep : parent->deps) {
-            if (IsSysLib(dep->lib)) {
+            if (IsSysLib(dep_tree.nodes[dep].lib) || lib_dedup[dep]) {
                 continue;
             }
 
-            auto ret_pair = lib_dedup.insert(dep);
-            if (ret_pair.second) {
-                q.push_back(dep);
-            }
+            lib_dedup[dep] = 1;
+            q.push_back(dep);
         }
     }
 
     string content;
     for (auto inc : inc_dedup) {
-        content += " -I" + inc;
+        content += " -I" + ToRelativePath(inc);
     }
     return content;
 }
 
+/* `seq` is the index of `src` in its dependency so that every target gets the same name */
 static string GenerateObjectName(const string& src, const string& dep_name,
                                  size_t seq) {
     const int offset = FindParentDirPos(src.data(), src.size()) + 1;
@@ -453,71 +790,265 @@ static string GenerateObjectName(const string& src, const string& dep_name,
     return dep_name + "." + base_name + ".o";
 }
 
-static string GenerateObjBuildInfo(const Target* target,
-                                   const unordered_map<LibInfo, DepTreeNode, LibInfoHash>& dep_tree,
-                                   unordered_set<string>* obj_of_target,
-                                   unordered_set<string>* obj_dedup) {
-    string content;
+#define UNITY_DIR ".omake/unity"
+
+/* writes `srcs` into `dir`/unity_N.`ext` by batch and returns the file names */
+static void GenerateUnitySources(const vector<string>& srcs, size_t batch_size,
+                                 const string& dir, const char* ext,
+                                 vector<string>* units) {
+    if (!MakeDirs(dir)) {
+        return;
+    }
+
+    // unity files are 3 levels below the current dir
+    for (size_t i = 0; i < srcs.size(); i += batch_size) {
+        if (i + 1 == srcs.size()) { // no need to wrap a single source
+            units->push_back(srcs[i]);
+            break;
+        }
 
+        string content = "/* generated by omake. DO NOT EDIT! */\n\n";
+        for (size_t j = i; j < srcs.size() && j < i + batch_size; ++j) {
+            const string& src = srcs[j];
+            content += "#include \"" + ((src[0] == '/') ? src : ("../../../" + src)) + "\"\n";
+        }
+
+        const string fname = dir + "/unity_" + std::to_string(i / batch_size) + "." + ext;
+        if (!WriteFileIfChanged(fname, content)) {
+            cerr << "write unity file [" << fname << "] failed." << endl;
+        }
+        units->push_back(fname);
+    }
+}
+
+/*
+  sources of `dep` to be compiled. sources are grouped into unity files if
+  unity build is enabled, except those excluded by the dependency.
+*/
+static void CollectCompileUnits(const Dependency* dep, int default_batch_size,
+                                vector<string>* c_units, vector<string>* cpp_units) {
+    int batch_size = dep->GetUnityBatchSize();
+    if (batch_size < 0) {
+        batch_size = default_batch_size;
+    }
+
+    vector<string> c_batch, cpp_batch;
+    dep->ForEachCSource([&] (const string& src) {
+        if (batch_size > 1 && !dep->IsExcludedFromUnityBuild(src)) {
+            c_batch.push_back(src);
+        } else {
+            c_units->push_back(src);
+        }
+    });
+    dep->ForEachCppSource([&] (const string& src) {
+        if (batch_size > 1 && !dep->IsExcludedFromUnityBuild(src)) {
+            cpp_batch.push_back(src);
+        } else {
+            cpp_units->push_back(src);
+        }
+    });
+
+    const string dir = string(UNITY_DIR) + "/" + dep->GetName();
+    if (!c_batch.empty()) {
+        GenerateUnitySources(c_batch, batch_size, dir, "c", c_units);
+    }
+    if (!cpp_batch.empty()) {
+        GenerateUnitySources(cpp_batch, batch_size, dir, "cpp", cpp_units);
+    }
+}
+
+/* `lang` is needed because C and C++ sources can't share a precompiled header */
+static string GeneratePchName(const string& header, const string& dep_name,
+                              const char* lang) {
+    const int offset = FindParentDirPos(header.data(), header.size()) + 1;
+    return dep_name + "." + lang + "." + header.substr(offset) + ".gch";
+}
+
+/*
+  objects are named after dependencies and shared by all targets using a dependency of the
+  same name, which may be different instances for in-tree libraries. so names of those linked
+  into any shared library are collected, and their objects are built with -fPIC for every
+  target. static libraries built by this Makefile are linked into the shared libraries
+  depending on them, and count as well.
+*/
+static void CollectPicDependencies(const vector<const Target*>& target_list,
+                                   const DepTree& dep_tree, unordered_set<string>* pic_deps) {
+    auto add_deps = [pic_deps] (const Target* target) {
+        target->ForEachDependency([pic_deps] (const Dependency* dep) {
+            if (!dep->HasFlag("-fPIC") && !dep->HasFlag("-fpic")) {
+                pic_deps->insert(dep->GetName());
+            }
+        });
+    };
+
+    unordered_map<LibInfo, const Target*, LibInfoHash> static_libs; // built by this Makefile
+    for (auto target : target_list) {
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            static_libs.insert(make_pair(LibInfo(target->GetDir(), target->GetName(),
+                                                 OMAKE_TYPE_STATIC), target));
+        }
+    }
+
+    vector<int> stack;
+    for (auto target : target_list) {
+        if (target->GetType() != OMAKE_TYPE_SHARED) {
+            continue;
+        }
+        add_deps(target);
+        target->ForEachDependency([&dep_tree, &stack] (const Dependency* dep) {
+            dep->ForEachLibrary([&dep_tree, &stack] (const LibInfo& lib) {
+                auto ref = dep_tree.ids.find(lib);
+                if (ref != dep_tree.ids.end()) {
+                    stack.push_back(ref->second);
+                }
+            });
+        });
+    }
+
+    // shared libraries in between link their own static libraries
+    vector<char> visited(dep_tree.nodes.size(), 0);
+    while (!stack.empty()) {
+        const int id = stack.back();
+        stack.pop_back();
+        if (visited[id]) {
+            continue;
+        }
+        visited[id] = 1;
+
+        const DepTreeNode& node = dep_tree.nodes[id];
+        if (node.lib.type != OMAKE_TYPE_STATIC) {
+            continue;
+        }
+        auto ref = static_libs.find(node.lib);
+        if (ref != static_libs.end()) {
+            add_deps(ref->second);
+        }
+        stack.insert(stack.end(), node.deps.begin(), node.deps.end());
+    }
+}
+
+/* an object to be built and the source it is built from */
+struct ObjBuildItem final {
+    ObjBuildItem(const string& _src, string&& _obj) : src(&_src), obj(std::move(_obj)) {}
+    const string* src;
+    string obj;
+};
+
+static void GenerateObjBuildInfo(const Target* target,
+                                 const DepTree& dep_tree,
+                                 int unity_batch_size,
+                                 unordered_set<string>* obj_of_target,
+                                 unordered_set<string>* pch_of_target,
+                                 unordered_set<string>* obj_dedup,
+                                 const unordered_set<string>& pic_deps,
+                                 Emitter* out) {
     target->ForEachDependency([&] (const Dependency* dep) {
         const string& dep_name = dep->GetName();
         const string dep_inc_str = GenerateDepInc(dep, dep_tree);
+        const string& pch = dep->GetPrecompiledHeader();
+        const string stats = "$(call omake_stats," + target->GetName() + "," + dep_name + ") ";
+        const string pgo = " $(call omake_pgo," + dep_name + ")";
 
         string flags;
         dep->ForEachFlag([&flags] (const string& flag) {
             flags += " " + flag;
         });
+        if (pic_deps.find(dep_name) != pic_deps.end()) {
+            flags += " -fPIC";
+        }
 
         const string flag_var_name = dep->GetName() + "_FLAGS";
         const string inc_var_name = dep->GetName() + "_INCS";
 
-        string local_content;
-        dep->ForEachCSource([&] (const string& src) {
-            const string obj = GenerateObjectName(src, dep_name, obj_of_target->size());
-            obj_of_target->insert(obj);
-            auto ret_pair = obj_dedup->insert(obj);
-            if (ret_pair.second) {
-                local_content += obj + ": " + src + "\n" +
-                    "\t$(CC) $(CFLAGS)";
-                if (!flags.empty()) {
-                    local_content += " $(" + flag_var_name + ")";
-                }
-                if (!dep_inc_str.empty()) {
-                    local_content += " $(" + inc_var_name + ")";
-                }
-                local_content += " -c $< -o $@\n\n";
+        string c_pch, cpp_pch;
+        bool new_c_pch = false, new_cpp_pch = false;
+        if (!pch.empty()) {
+            if (dep->HasCSource()) {
+                c_pch = "$(omake_objdir)" + GeneratePchName(pch, dep_name, "c");
+                pch_of_target->insert(c_pch);
+                new_c_pch = obj_dedup->insert(c_pch).second;
             }
-        });
+            if (dep->HasCppSource()) {
+                cpp_pch = "$(omake_objdir)" + GeneratePchName(pch, dep_name, "cpp");
+                pch_of_target->insert(cpp_pch);
+                new_cpp_pch = obj_dedup->insert(cpp_pch).second;
+            }
+        }
 
-        dep->ForEachCppSource([&] (const string& src) {
-            const string obj = GenerateObjectName(src, dep_name, obj_of_target->size());
-            obj_of_target->insert(obj);
-            auto ret_pair = obj_dedup->insert(obj);
-            if (ret_pair.second) {
-                local_content += obj + ": " + src + "\n" +
-                    "\t$(CXX) $(CXXFLAGS)";
-                if (!flags.empty()) {
-                    local_content += " $(" + flag_var_name + ")";
+        vector<string> c_units, cpp_units;
+        CollectCompileUnits(dep, unity_batch_size, &c_units, &cpp_units);
+
+        // objects not emitted by other targets
+        size_t seq = 0;
+        auto collect_objs = [&] (const vector<string>& units, vector<ObjBuildItem>* items) {
+            for (auto& src : units) {
+                string obj = "$(omake_objdir)" + GenerateObjectName(src, dep_name, seq++);
+                obj_of_target->insert(obj);
+                if (obj_dedup->insert(obj).second) {
+                    items->push_back(ObjBuildItem(src, std::move(obj)));
                 }
-                if (!dep_inc_str.empty()) {
-                    local_content += " $(" + inc_var_name + ")";
-                }
-                local_content += " -c $< -o $@\n\n";
             }
-        });
+        };
+
+        vector<ObjBuildItem> c_items, cpp_items;
+        collect_objs(c_units, &c_items);
+        collect_objs(cpp_units, &cpp_items);
 
-        if (!local_content.empty()) {
+        if (!new_c_pch && !new_cpp_pch && c_items.empty() && cpp_items.empty()) {
+            return;
+        }
+
+        if (!dep_inc_str.empty()) {
+            *out << inc_var_name << " :=" << dep_inc_str << "\n\n";
+        }
+        if (!flags.empty()) {
+            *out << flag_var_name << " :=" << flags << "\n\n";
+        }
+
+        auto gen_vars = [&] () {
+            if (!flags.empty()) {
+                *out << " $(" << flag_var_name << ")";
+            }
             if (!dep_inc_str.empty()) {
-                content += inc_var_name + " :=" + dep_inc_str + "\n\n";
+                *out << " $(" << inc_var_name << ")";
             }
-            if (!flags.empty()) {
-                content += flag_var_name + " :=" + flags + "\n\n";
+        };
+
+        // built with the same flags as objects of this dependency
+        auto gen_pch = [&] (const string& gch, const char* compiler, const char* xlang) {
+            *out << gch << ": " << pch << "\n\t" << stats << compiler;
+            gen_vars();
+            *out << pgo << " -x " << xlang << " -MMD -MP -c $< -o $@\n\n";
+        };
+
+        if (new_c_pch) {
+            gen_pch(c_pch, "$(launcher) $(CC) $(CFLAGS)", "c-header");
+        }
+        if (new_cpp_pch) {
+            gen_pch(cpp_pch, "$(launcher) $(CXX) $(CXXFLAGS)", "c++-header");
+        }
+
+        auto gen_obj = [&] (const ObjBuildItem& item, const char* compiler, const string& gch) {
+            *out << item.obj << ": " << *item.src;
+            if (!gch.empty()) {
+                *out << " " << gch;
+            }
+            *out << "\n\t" << stats << compiler;
+            gen_vars();
+            *out << pgo;
+            if (!gch.empty()) {
+                *out << " -Winvalid-pch -include " << gch.substr(0, gch.size() - 4);
             }
-            content += local_content;
+            *out << " -MMD -MP -c $< -o $@\n\n";
+        };
+
+        for (auto& item : c_items) {
+            gen_obj(item, "$(launcher) $(CC) $(CFLAGS)", c_pch);
+        }
+        for (auto& item : cpp_items) {
+            gen_obj(item, "$(launcher) $(CXX) $(CXXFLAGS)", cpp_pch);
         }
     });
-
-    return content;
 }
 
 static string GenerateTargetDepLabels(const Target* target,
@@ -533,9 +1064,9 @@ static string GenerateTargetDepLabels(const Target* target,
                 const int type = lib.type;
                 string local_lib_name;
                 if (type == OMAKE_TYPE_STATIC) {
-                    local_lib_name = "lib" + lib.name + ".a";
+                    local_lib_name = MAKE_OUT_DIR "lib" + lib.name + ".a";
                 } else {
-                    local_lib_name = "lib" + lib.name + ".so";
+                    local_lib_name = MAKE_OUT_DIR "lib" + lib.name + ".so";
                 }
                 label_dedup.insert(std::move(local_lib_name));
             }
@@ -549,19 +1080,71 @@ static string GenerateTargetDepLabels(const Target* target,
     return content;
 }
 
-static string GetGeneratedName(const Target* target) {
+/* `outdir` is relative to the dir of `target` */
+static string GetGeneratedName(const Target* target, const string& outdir = string()) {
+    const string prefix = ((target->GetDir() == ".") ? string() : (target->GetDir() + "/")) + outdir;
+
     const int type = target->GetType();
     if (type == OMAKE_TYPE_BINARY) {
-        return target->GetName();
+        return prefix + target->GetName();
     } else if (type == OMAKE_TYPE_STATIC) {
-        return "lib" + target->GetName() + ".a";
+        return prefix + "lib" + target->GetName() + ".a";
     } else if (type == OMAKE_TYPE_SHARED) {
-        return "lib" + target->GetName() + ".so";
+        return prefix + "lib" + target->GetName() + ".so";
     }
 
     return string();
 }
 
+/* prefix of make variables of `target` */
+static string GetVarPrefix(const Target* target) {
+    if (target->GetDir() == ".") {
+        return target->GetName();
+    }
+    return PathToName(target->GetDir()) + "." + target->GetName();
+}
+
+/* in-tree libraries `target` depends on, directly or indirectly */
+static string GenerateTargetDepLibFiles(const Target* target,
+                                        const DepTree& dep_tree) {
+    list<int> q;
+    vector<char> node_dedup(dep_tree.nodes.size(), 0);
+    set<string> file_list;
+
+    auto handle_node = [&q, &node_dedup, &file_list, &dep_tree] (int id) {
+        const LibInfo& lib = dep_tree.nodes[id].lib;
+        if (node_dedup[id] || IsSysLib(lib) || IsThirdPartyLib(lib)) {
+            return;
+        }
+        node_dedup[id] = 1;
+
+        const string fname = (lib.type == OMAKE_TYPE_STATIC)
+            ? (MAKE_OUT_DIR "lib" + lib.name + ".a") : (MAKE_OUT_DIR "lib" + lib.name + ".so");
+        file_list.insert(IsLocalLib(lib) ? fname : (lib.path + "/" + fname));
+        q.push_back(id);
+    };
+
+    target->ForEachDependency([&dep_tree, &handle_node] (const Dependency* dep) {
+        dep->ForEachLibrary([&dep_tree, &handle_node] (const LibInfo& lib) {
+            handle_node(dep_tree.Id(lib));
+        });
+    });
+
+    while (!q.empty()) {
+        auto parent = q.front();
+        q.pop_front();
+        for (auto dep : dep_tree.nodes[parent].deps) {
+            handle_node(dep);
+        }
+    }
+
+    string content;
+    for (auto& fname : file_list) {
+        content += " " + fname;
+    }
+    return content;
+}
+
 static string CollectFlagsForTarget(const Target* target) {
     string content;
     unordered_set<string> dedup;
@@ -574,14 +1157,51 @@ static string CollectFlagsForTarget(const Target* target) {
 }
 
 bool Project::GenerateMakefile(const string& fname) {
-    string content = "# This Makefile is generated by omake: https://github.com/ouonline/omake.git\n\n";
+    ProfileScope scope("GenerateMakefile");
 
-    bool has_c = false, has_cpp = false;
+    // pre process for dependencies
+    ResidentState local_state;
+    ResidentState* state = m_resident ? m_resident : &local_state;
+    UpdateDepTree(m_targets, state);
+    DepCache& cache = state->cache;
+    const DepTree& dep_tree = state->dep_tree;
+    CollectGeneratorInputs(m_targets, m_base_dir, dep_tree, &cache, &m_generator_inputs);
+
+    vector<const Target*> target_list;
     for (auto iter : m_targets) {
-        if (iter.second->HasCSource()) {
+        target_list.push_back(iter.second);
+    }
+
+    // in-tree libraries are built by this Makefile instead of sub-makes
+    vector<unique_ptr<Dependency>> sub_deps;
+    vector<unique_ptr<Target>> sub_targets;
+    bool ok = true;
+    if (m_non_recursive) {
+        ok = CreateSubTargets(dep_tree, &cache, &sub_deps, &sub_targets);
+        for (auto& target : sub_targets) {
+            target_list.push_back(target.get());
+        }
+    }
+
+    // projects evaluated successfully are kept anyway
+    cache.Save(OMAKE_DEP_CACHE_FILE);
+    if (!ok) {
+        return false;
+    }
+
+    Emitter out;
+    if (!out.Open(fname)) {
+        return false;
+    }
+
+    out << "# This Makefile is generated by omake: https://github.com/ouonline/omake.git\n\n";
+
+    bool has_c = false, has_cpp = false;
+    for (auto target : target_list) {
+        if (target->HasCSource()) {
             has_c = true;
         }
-        if (iter.second->HasCppSource()) {
+        if (target->HasCppSource()) {
             has_cpp = true;
         }
         if (has_c && has_cpp) {
@@ -590,136 +1210,680 @@ bool Project::GenerateMakefile(const string& fname) {
     }
 
     if (has_c) {
-        content += "CC := gcc\n"
+        out << "CC := gcc\n"
             "\n"
             "ifeq ($(debug), y)\n"
-            "\tCFLAGS += -g\n"
+            "\tCFLAGS += -g -gsplit-dwarf\n"
             "else\n"
             "\tCFLAGS += -O2 -DNDEBUG\n"
             "endif\n"
             "\n";
     }
     if (has_cpp) {
-        content += "CXX := g++\n"
+        out << "CXX := g++\n"
             "\n"
             "ifeq ($(debug), y)\n"
-            "\tCXXFLAGS += -g\n"
+            "\tCXXFLAGS += -g -gsplit-dwarf\n"
             "else\n"
             "\tCXXFLAGS += -O2 -DNDEBUG\n"
             "endif\n"
             "\n";
     }
 
-    for (auto iter : m_targets) {
-        if (iter.second->GetType() == OMAKE_TYPE_STATIC) {
-            content += "AR := ar\n\n";
+    bool has_static = false;
+    for (auto target : target_list) {
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            out << "AR := ar\n\n";
+            // all objects if any of $(1), e.g. the object list, changed. objects may have been removed.
+            out << "omake_ar_inputs = $(filter-out $(1),$(if $(filter $(1),$?),$^,$?))\n\n";
+            has_static = true;
             break;
         }
     }
 
-    content += "TARGET :=";
+    // `lto=y` for gcc and `lto=thin` for clang. `-flto=auto` makes gcc run ltrans jobs in parallel.
+    out << "ifeq ($(lto), y)\n";
+    if (has_c) {
+        out << "\tCFLAGS += -flto=auto\n";
+    }
+    if (has_cpp) {
+        out << "\tCXXFLAGS += -flto=auto\n";
+    }
+    if (has_static) {
+        out << "\tAR := gcc-ar\n";
+    }
+    // gcc does not support `-flto=thin`
+    out << "else ifeq ($(lto), thin)\n";
+    if (has_c) {
+        out << "\tCC := clang\n"
+            "\tCFLAGS += -flto=thin\n";
+    }
+    if (has_cpp) {
+        out << "\tCXX := clang++\n"
+            "\tCXXFLAGS += -flto=thin\n";
+    }
+    if (has_static) {
+        out << "\tAR := llvm-ar\n";
+    }
+    out << "endif\n\n";
+
+    // `make builddir=build` keeps objects and linked files of each variant in build/<variant>/
+    out << "ifneq ($(builddir),)\n"
+        "\tomake_variant := $(builddir)/$(if $(filter y,$(debug)),debug,release)$(if $(lto),-lto-$(lto))\n"
+        "endif\n\n";
+
+    /*
+      `make pgo=gen`, run the training, then `make pgo=use`. objects of each mode are kept apart.
+      profiles are looked up by the name of the instrumented object, hence `-dumpdir`.
+    */
+    out << "ifeq ($(pgo), gen)\n"
+        "\tomake_objdir := $(if $(omake_variant),$(omake_variant)-pgo-gen/,.omake/pgo/gen/)\n";
+    if (has_c) {
+        out << "\tCFLAGS += -fprofile-generate -fprofile-update=prefer-atomic\n";
+    }
+    if (has_cpp) {
+        out << "\tCXXFLAGS += -fprofile-generate -fprofile-update=prefer-atomic\n";
+    }
+    out << "\tomake_pgo = -fprofile-generate=$(CURDIR)/.omake/pgo/data/$(1)\n"
+        "else ifeq ($(pgo), use)\n"
+        "\tomake_objdir := $(if $(omake_variant),$(omake_variant)-pgo-use/,.omake/pgo/use/)\n";
+    if (has_c) {
+        out << "\tCFLAGS += -fprofile-use -fprofile-partial-training -Wno-missing-profile\n";
+    }
+    if (has_cpp) {
+        out << "\tCXXFLAGS += -fprofile-use -fprofile-partial-training -Wno-missing-profile\n";
+    }
+    out << "\tomake_pgo = -fprofile-use=$(CURDIR)/.omake/pgo/data/$(1) "
+        "-dumpdir $(if $(omake_variant),$(omake_variant)-pgo-gen/,.omake/pgo/gen/)\n"
+        "else ifneq ($(omake_variant),)\n"
+        "\tomake_objdir := $(omake_variant)/\n"
+        "endif\n\n";
+
+    out << "ifneq ($(omake_variant),)\n"
+        "\tomake_outdir := $(omake_objdir)\n"
+        "endif\n\n";
+
+    // `make launcher=` disables it
+    if (!m_launcher.empty()) {
+        out << "launcher ?= " << m_launcher << "\n\n";
+    }
+
+    // `make linker=` uses the default one. bfd does not support `--gdb-index`.
+    if (!m_linker.empty()) {
+        out << "linker ?= " << m_linker << "\n\n";
+    }
+    out << "ifeq ($(debug), y)\n"
+        "\tomake_ldflags = $(if $(1),-fuse-ld=$(1))$(if $(filter-out bfd,$(1)), -Xlinker --gdb-index)\n"
+        "else\n"
+        "\tomake_ldflags = $(if $(1),-fuse-ld=$(1))\n"
+        "endif\n\n";
+
+    out << "OMAKE ?= omake\n\n";
+
+    // `make stats=y` records each command for `omake report`
+    out << "ifeq ($(stats), y)\n"
+        "\tomake_stats = $(OMAKE) record " OMAKE_STATS_LOG_FILE " $(1) $(2) $@ --\n"
+        "endif\n\n";
+
+    out << "TARGET :=";
     for (auto iter : m_targets) {
-        content += " " + GetGeneratedName(iter.second);
+        out << " " << GetGeneratedName(iter.second, MAKE_OUT_DIR);
+    }
+    out << "\n\n";
+
+    out << "ifneq ($(omake_objdir),)\n"
+        "$(shell mkdir -p $(omake_objdir)";
+    for (auto& target : sub_targets) {
+        out << " " << target->GetDir() << "/$(omake_outdir)";
     }
-    content += "\n\n";
+    out << ")\n"
+        "endif\n\n";
 
-    content += ".PHONY: all clean distclean\n"
+    out << ".PHONY: all clean distclean pgo-clean\n"
         "\n"
         "all: $(TARGET)\n"
         "\n";
 
-    // pre process for dependencies
-    unordered_map<LibInfo, DepTreeNode, LibInfoHash> dep_tree;
-    for (auto iter : m_targets) {
-        GenerateDepTree(iter.second, &dep_tree);
+    if (!m_pgo_training.empty()) {
+        out << ".PHONY: pgo\n"
+            "pgo:\n"
+            "\t$(MAKE) pgo=gen\n"
+            "\t$(MAKE) pgo-clean\n"
+            "\t" << m_pgo_training << "\n"
+            "\t$(MAKE) pgo=use\n\n";
     }
 
+    /*
+      linked files depend on a stamp of the `pgo` mode so that they are relinked with objects of
+      that mode. it is rewritten only when the mode changes. variants have their own linked files.
+    */
+    out << "ifeq ($(builddir),)\n"
+        "omake_pgo_stamp := .omake/pgo/mode\n"
+        "ifneq ($(shell cat $(omake_pgo_stamp) 2>/dev/null), $(pgo))\n"
+        ".PHONY: $(omake_pgo_stamp)\n"
+        "endif\n"
+        "$(omake_pgo_stamp):\n"
+        "\t@mkdir -p $(@D) && echo $(pgo) > $@\n"
+        "endif\n\n";
+
+    unordered_set<string> pic_deps;
+    CollectPicDependencies(target_list, dep_tree, &pic_deps);
+
     unordered_set<string> obj_dedup;
     unordered_map<LibInfo, string, LibInfoHash> node2label;
 
-    for (auto iter : m_targets) {
-        auto target = iter.second;
-        const string lib_var_name = target->GetName() + "_LIBS";
-        const string obj_var_name = target->GetName() + "_OBJS";
+    for (auto target : target_list) {
+        const string var_prefix = GetVarPrefix(target);
+        const string lib_var_name = var_prefix + "_LIBS";
+        const string obj_var_name = var_prefix + "_OBJS";
+        const string pch_var_name = var_prefix + "_PCHS";
 
-        unordered_map<const DepTreeNode*, int> node2in;
-        CalcInDegree(target, dep_tree, &node2in);
+        vector<int> in_degree;
+        CalcInDegree(target, dep_tree, &in_degree);
 
-        content += GeneratePhonyBuildInfo(target, dep_tree, node2in, &node2label);
+        if (!m_non_recursive) {
+            GeneratePhonyBuildInfo(target, dep_tree, in_degree, &node2label, &out);
+        }
 
-        unordered_set<string> obj_of_target;
-        content += GenerateObjBuildInfo(target, dep_tree, &obj_of_target, &obj_dedup);
+        unordered_set<string> obj_of_target, pch_of_target;
+        GenerateObjBuildInfo(target, dep_tree, m_unity_batch_size,
+                             &obj_of_target, &pch_of_target, &obj_dedup, pic_deps, &out);
 
-        content += obj_var_name + " :=" + GenerateObjects(obj_of_target) + "\n\n";
+        out << obj_var_name << " :=";
+        GenerateObjects(obj_of_target, &out);
+        out << "\n\n";
+
+        // header dependencies generated by `-MMD -MP`
+        out << "-include $(" << obj_var_name << ":.o=.d)\n\n";
+
+        if (!pch_of_target.empty()) {
+            out << pch_var_name << " :=";
+            GenerateObjects(pch_of_target, &out);
+            out << "\n\n-include $(" << pch_var_name << ":.gch=.d)\n\n";
+        }
 
         string target_dep_libs;
         if (target->GetType() == OMAKE_TYPE_BINARY ||
             target->GetType() == OMAKE_TYPE_SHARED) {
-            target_dep_libs = GenerateTargetDepLibs(target, dep_tree, &node2in);
+            target_dep_libs = GenerateTargetDepLibs(target, dep_tree, MAKE_OUT_DIR, &in_degree);
             if (!target_dep_libs.empty()) {
-                content += lib_var_name + " :=" + target_dep_libs + "\n\n";
+                out << lib_var_name << " :=" << target_dep_libs << "\n\n";
             }
         }
 
-        content += GetGeneratedName(target) + ": $(" + obj_var_name + ")";
-
-        const string dep_label_str = GenerateTargetDepLabels(target, node2label);
-        if (!dep_label_str.empty()) {
-            content += " |" + dep_label_str;
+        // archives are rebuilt from scratch if any of these changes, e.g. objects are removed
+        string ar_stamp, ar_full_inputs;
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            ar_stamp = WriteArchiveStamp(var_prefix, obj_of_target, m_thin_archive);
+            ar_full_inputs = ar_stamp + " $(omake_pgo_stamp)";
         }
 
-        string cmd;
+        out << GetGeneratedName(target, MAKE_OUT_DIR) << ": $(" << obj_var_name << ")";
         if (target->GetType() == OMAKE_TYPE_STATIC) {
-            cmd = "$(AR) rc $@ $^";
+            out << " " << ar_full_inputs;
         } else {
-            const string extra_flags = CollectFlagsForTarget(target);
-
-            if (target->GetType() == OMAKE_TYPE_BINARY) {
-                if (target->HasCppSource()) {
-                    cmd = "$(CXX) $(CXXFLAGS)" + extra_flags +
-                        " -o $@ $^";
-                    if (!target_dep_libs.empty()) {
-                        cmd += " $(" + lib_var_name + ")";
-                    }
-                } else if (target->HasCSource()) {
-                    cmd = "$(CC) $(CFLAGS)" + extra_flags +
-                        " -o $@ $^";
-                    if (!target_dep_libs.empty()) {
-                        cmd += " $(" + lib_var_name + ")";
-                    }
-                }
-            } else if (target->GetType() == OMAKE_TYPE_SHARED) {
-                if (target->HasCppSource()) {
-                    cmd = "$(CXX) $(CXXFLAGS)" + extra_flags +
-                        " -shared -o $@ $^";
-                    if (!target_dep_libs.empty()) {
-                        cmd += " $(" + lib_var_name + ")";
-                    }
-                } else if (target->HasCSource()) {
-                    cmd = "$(CC) $(CFLAGS)" + extra_flags +
-                        " -shared -o $@ $^";
-                    if (!target_dep_libs.empty()) {
-                        cmd += " $(" + lib_var_name + ")";
-                    }
+            out << " $(omake_pgo_stamp)";
+        }
+
+        // libraries may be prerequisites in non-recursive mode
+        if (m_non_recursive) {
+            const string dep_lib_files = GenerateTargetDepLibFiles(target, dep_tree);
+            if (!dep_lib_files.empty()) {
+                if (target->GetType() == OMAKE_TYPE_STATIC) {
+                    out << " |" << dep_lib_files;
+                } else {
+                    out << dep_lib_files;
                 }
             }
+        } else {
+            const string dep_label_str = GenerateTargetDepLabels(target, node2label);
+            if (!dep_label_str.empty()) {
+                out << " |" << dep_label_str;
+            }
+        }
+
+        // archives are updated with changed objects only
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            out << "\n\t$(if $(filter " << ar_full_inputs << ",$?),rm -f $@)";
+        }
+        out << "\n\t$(call omake_stats," << target->GetName() << ",link) ";
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            out << "$(AR) " << (m_thin_archive ? "rcsDT" : "rcsD")
+                << " $@ $(call omake_ar_inputs," << ar_full_inputs << ")";
+        } else {
+            if (target->HasCppSource()) {
+                out << "$(CXX) $(CXXFLAGS)";
+            } else if (target->HasCSource()) {
+                out << "$(CC) $(CFLAGS)";
+            }
+            out << CollectFlagsForTarget(target);
+            if (target->GetType() == OMAKE_TYPE_SHARED) {
+                out << " -shared";
+            }
+            out << " $(call omake_ldflags,"
+                << (target->GetLinker().empty() ? "$(linker)" : target->GetLinker()) << ")";
+            out << " -o $@ $(" << obj_var_name << ")";
+            if (!target_dep_libs.empty()) {
+                out << " $(" << lib_var_name << ")";
+            }
+        }
+        out << "\n\n";
+
+        // removing .omake makes a full rebuild instead of an error
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            out << ar_stamp << ":\n\n";
         }
+    }
+
+    /*
+      dirs are newer when entries are added or removed. `touch` is needed because omake keeps
+      the mtime of an unchanged file.
+    */
+    out << fname << ":";
+    for (auto& iter : m_generator_inputs) {
+        out << " " << iter.first;
+    }
+    out << "\n"
+        "\t$(OMAKE)\n"
+        "\t@touch $@\n\n";
 
-        content += "\n\t" + cmd + "\n\n";
+    // like `-MP` for headers, so that removing a dir or sub-project regenerates instead of failing
+    for (auto& iter : m_generator_inputs) {
+        out << iter.first << ":\n";
     }
+    out << "\n";
 
-    content += "clean:\n"
+    out << "clean:\n"
         "\trm -f $(TARGET)";
-    for (auto iter : m_targets) {
-        content += " $(" + iter.second->GetName() + "_OBJS)";
+    for (auto& target : sub_targets) {
+        out << " " << GetGeneratedName(target.get(), MAKE_OUT_DIR);
     }
-    content += "\n\n";
+    for (auto target : target_list) {
+        const string var_prefix = GetVarPrefix(target);
+        const string obj_var_name = var_prefix + "_OBJS";
+        out << " $(" << obj_var_name << ") $(" << obj_var_name << ":.o=.d) $("
+            << obj_var_name << ":.o=.dwo)";
+        if (target->HasPrecompiledHeader()) {
+            const string pch_var_name = var_prefix + "_PCHS";
+            out << " $(" << pch_var_name << ") $(" << pch_var_name << ":.gch=.d)";
+        }
+    }
+    out << "\n"
+        "\trm -rf .omake/pgo/gen .omake/pgo/use\n\n";
 
-    content += "distclean:\n"
+    out << "distclean:\n"
         "\t$(MAKE) clean\n";
-    for (auto dep : node2label) {
-        content += "\t$(MAKE) distclean -C " + dep.first.path + "\n";
+    for (auto& dep : node2label) {
+        out << "\t$(MAKE) distclean -C " << dep.first.path << "\n";
+    }
+
+    // profiles are accumulated, so stale ones are removed before training
+    out << "\n"
+        "pgo-clean:\n"
+        "\trm -rf .omake/pgo/data\n";
+    for (auto& dep : node2label) {
+        out << "\t$(MAKE) pgo-clean -C " << dep.first.path << "\n";
+    }
+
+    return out.Commit();
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void GenerateNinjaSubBuildInfo(const Target* target,
+                                      const DepTree& dep_tree,
+                                      const vector<int>& in_degree,
+                                      unordered_map<LibInfo, string, LibInfoHash>* node2out,
+                                      Emitter* out) {
+    vector<const DepTreeNode*> node_list;
+
+    target->ForEachDependency([&dep_tree, &in_degree, &node_list] (const Dependency* dep) {
+        dep->ForEachLibrary([&dep_tree, &in_degree, &node_list] (const LibInfo& lib) {
+            const int id = dep_tree.Id(lib);
+            if (in_degree[id] == 1) {
+                node_list.push_back(&dep_tree.nodes[id]);
+            }
+        });
+    });
+
+    for (auto iter : node_list) {
+        const LibInfo& lib = iter->lib;
+        if ((!IsLocalLib(lib)) && (!IsSysLib(lib)) && (!IsThirdPartyLib(lib))) {
+            const string target_name = (lib.type == OMAKE_TYPE_STATIC)
+                ? ("lib" + lib.name + ".a")
+                : ("lib" + lib.name + ".so");
+            auto ret_pair = node2out->insert(make_pair(lib, lib.path + "/" + target_name));
+            if (ret_pair.second) {
+                *out << "build " << ret_pair.first->second << ": omake_sub_ninja | omake_always\n"
+                     << "  dir = " << lib.path << "\n"
+                     << "  target = " << target_name << "\n\n";
+            }
+        }
+    }
+}
+
+static void GenerateNinjaObjBuildInfo(const Target* target,
+                                      const DepTree& dep_tree,
+                                      int unity_batch_size,
+                                      unordered_set<string>* obj_of_target,
+                                      unordered_set<string>* obj_dedup,
+                                      const unordered_set<string>& pic_deps,
+                                      Emitter* out) {
+    target->ForEachDependency([&] (const Dependency* dep) {
+        const string& dep_name = dep->GetName();
+        const string dep_inc_str = GenerateDepInc(dep, dep_tree);
+        const string& pch = dep->GetPrecompiledHeader();
+
+        string flags;
+        dep->ForEachFlag([&flags] (const string& flag) {
+            flags += " " + flag;
+        });
+        if (pic_deps.find(dep_name) != pic_deps.end()) {
+            flags += " -fPIC";
+        }
+
+        const string flag_var_name = dep_name + "_flags";
+        const string inc_var_name = dep_name + "_incs";
+
+        string c_pch, cpp_pch;
+        bool new_c_pch = false, new_cpp_pch = false;
+        if (!pch.empty()) {
+            if (dep->HasCSource()) {
+                c_pch = GeneratePchName(pch, dep_name, "c");
+                new_c_pch = obj_dedup->insert(c_pch).second;
+            }
+            if (dep->HasCppSource()) {
+                cpp_pch = GeneratePchName(pch, dep_name, "cpp");
+                new_cpp_pch = obj_dedup->insert(cpp_pch).second;
+            }
+        }
+
+        vector<string> c_units, cpp_units;
+        CollectCompileUnits(dep, unity_batch_size, &c_units, &cpp_units);
+
+        // objects not emitted by other targets
+        size_t seq = 0;
+        auto collect_objs = [&] (const vector<string>& units, vector<ObjBuildItem>* items) {
+            for (auto& src : units) {
+                string obj = GenerateObjectName(src, dep_name, seq++);
+                obj_of_target->insert(obj);
+                if (obj_dedup->insert(obj).second) {
+                    items->push_back(ObjBuildItem(src, std::move(obj)));
+                }
+            }
+        };
+
+        vector<ObjBuildItem> c_items, cpp_items;
+        collect_objs(c_units, &c_items);
+        collect_objs(cpp_units, &cpp_items);
+
+        if (!new_c_pch && !new_cpp_pch && c_items.empty() && cpp_items.empty()) {
+            return;
+        }
+
+        if (!dep_inc_str.empty()) {
+            *out << inc_var_name << " =" << dep_inc_str << "\n\n";
+        }
+        if (!flags.empty()) {
+            *out << flag_var_name << " =" << flags << "\n\n";
+        }
+
+        auto gen_vars = [&] () {
+            if (!flags.empty()) {
+                *out << "  flags = $" << flag_var_name << "\n";
+            }
+            if (!dep_inc_str.empty()) {
+                *out << "  incs = $" << inc_var_name << "\n";
+            }
+        };
+
+        auto gen_pch = [&] (const string& gch, const char* rule) {
+            *out << "build " << gch << ": " << rule << " " << pch << "\n";
+            gen_vars();
+            *out << "\n";
+        };
+
+        if (new_c_pch) {
+            gen_pch(c_pch, "omake_cc_pch");
+        }
+        if (new_cpp_pch) {
+            gen_pch(cpp_pch, "omake_cxx_pch");
+        }
+
+        auto gen_obj = [&] (const ObjBuildItem& item, const char* rule, const string& gch) {
+            *out << "build " << item.obj << ": " << rule << " " << *item.src;
+            if (!gch.empty()) {
+                *out << " | " << gch;
+            }
+            *out << "\n";
+            gen_vars();
+            if (!gch.empty()) {
+                *out << "  pch = -Winvalid-pch -include " << gch.substr(0, gch.size() - 4) << "\n";
+            }
+            *out << "\n";
+        };
+
+        for (auto& item : c_items) {
+            gen_obj(item, "omake_cc", c_pch);
+        }
+        for (auto& item : cpp_items) {
+            gen_obj(item, "omake_cxx", cpp_pch);
+        }
+    });
+}
+
+static string GenerateNinjaImplicitDeps(const Target* target,
+                                        const unordered_map<LibInfo, string, LibInfoHash>& node2out) {
+    unordered_set<string> dedup;
+
+    target->ForEachDependency([&dedup, &node2out] (const Dependency* dep) {
+        dep->ForEachLibrary([&dedup, &node2out] (const LibInfo& lib) {
+            auto ref = node2out.find(lib);
+            if (ref != node2out.end()) {
+                dedup.insert(ref->second);
+            } else if (IsLocalLib(lib)) {
+                dedup.insert((lib.type == OMAKE_TYPE_STATIC)
+                             ? ("lib" + lib.name + ".a")
+                             : ("lib" + lib.name + ".so"));
+            }
+        });
+    });
+
+    string content;
+    for (auto out : dedup) {
+        content += " " + out;
+    }
+    return content;
+}
+
+bool Project::GenerateNinja(const string& fname, bool debug, const string& lto) {
+    ProfileScope scope("GenerateNinja");
+
+    Emitter out;
+    if (!out.Open(fname)) {
+        return false;
+    }
+
+    out << "# This file is generated by omake: https://github.com/ouonline/omake.git\n\n";
+
+    out << "ninja_required_version = 1.3\n\n";
+
+    string opt_flags = debug ? "-g -gsplit-dwarf" : "-O2 -DNDEBUG";
+    string cc = "gcc", cxx = "g++", ar = "ar";
+    if (lto == "y") {
+        opt_flags += " -flto=auto";
+        ar = "gcc-ar";
+    } else if (lto == "thin") {
+        opt_flags += " -flto=thin";
+        cc = "clang";
+        cxx = "clang++";
+        ar = "llvm-ar";
+    }
+
+    out << "cc = " << cc << "\n"
+        << "cflags = " << opt_flags << "\n"
+        << "cxx = " << cxx << "\n"
+        << "cxxflags = " << opt_flags << "\n"
+        << "ar = " << ar << "\n";
+    if (!m_launcher.empty()) {
+        out << "launcher = " << m_launcher << "\n";
+    }
+    // like `OMAKE ?= omake` in Makefiles. `$$` is a literal `$` for the shell.
+    out << "omake = $${OMAKE:-omake} --backend=ninja";
+    if (debug) {
+        out << " debug=y";
+    }
+    if (!lto.empty()) {
+        out << " lto=" << lto;
+    }
+    out << "\n\n";
+
+    out << "rule omake_cc\n"
+        "  command = $launcher $cc $cflags $flags $incs $pch -MMD -MF $out.d -c $in -o $out\n"
+        "  depfile = $out.d\n"
+        "  deps = gcc\n"
+        "  description = CC $out\n\n"
+        "rule omake_cxx\n"
+        "  command = $launcher $cxx $cxxflags $flags $incs $pch -MMD -MF $out.d -c $in -o $out\n"
+        "  depfile = $out.d\n"
+        "  deps = gcc\n"
+        "  description = CXX $out\n\n"
+        "rule omake_cc_pch\n"
+        "  command = $launcher $cc $cflags $flags $incs -x c-header -MMD -MF $out.d -c $in -o $out\n"
+        "  depfile = $out.d\n"
+        "  deps = gcc\n"
+        "  description = PCH $out\n\n"
+        "rule omake_cxx_pch\n"
+        "  command = $launcher $cxx $cxxflags $flags $incs -x c++-header -MMD -MF $out.d -c $in -o $out\n"
+        "  depfile = $out.d\n"
+        "  deps = gcc\n"
+        "  description = PCH $out\n\n"
+        "rule omake_ar\n"
+        "  command = rm -f $out && $ar " << (m_thin_archive ? "rcsDT" : "rcsD") << " $out $in\n"
+        "  description = AR $out\n\n"
+        "rule omake_link_c\n"
+        "  command = $cc $cflags $flags $ldflags -o $out $in $libs\n"
+        "  description = LINK $out\n\n"
+        "rule omake_link_cxx\n"
+        "  command = $cxx $cxxflags $flags $ldflags -o $out $in $libs\n"
+        "  description = LINK $out\n\n"
+        /*
+          sub-projects get their build.ninja (re)generated with the same options first. one at a
+          time since libraries of the same project share a dir.
+        */
+        "pool omake_sub\n"
+        "  depth = 1\n\n"
+        "rule omake_sub_ninja\n"
+        "  command = cd $dir && $omake && ninja $target\n"
+        "  description = NINJA $dir/$target\n"
+        "  pool = omake_sub\n"
+        "  restat = 1\n\n"
+        "build omake_always: phony\n\n";
+
+    ResidentState local_state;
+    ResidentState* state = m_resident ? m_resident : &local_state;
+    UpdateDepTree(m_targets, state);
+    DepCache& cache = state->cache;
+    const DepTree& dep_tree = state->dep_tree;
+
+    cache.Save(OMAKE_DEP_CACHE_FILE);
+
+    // ninja reloads the manifest after regenerating it. `restat` stops reruns if it is unchanged.
+    out << "rule omake_regen\n"
+        "  command = $omake\n"
+        "  description = OMAKE $out\n"
+        "  generator = 1\n"
+        "  restat = 1\n\n";
+    CollectGeneratorInputs(m_targets, m_base_dir, dep_tree, &cache, &m_generator_inputs);
+    out << "build " << fname << ": omake_regen";
+    for (auto& iter : m_generator_inputs) {
+        out << " " << iter.first;
+    }
+    out << "\n\n";
+    // missing inputs are out of date instead of errors
+    for (auto& iter : m_generator_inputs) {
+        out << "build " << iter.first << ": phony\n";
+    }
+    out << "\n";
+
+    vector<const Target*> target_list;
+    for (auto iter : m_targets) {
+        target_list.push_back(iter.second);
+    }
+    unordered_set<string> pic_deps;
+    CollectPicDependencies(target_list, dep_tree, &pic_deps);
+
+    unordered_set<string> obj_dedup;
+    unordered_map<LibInfo, string, LibInfoHash> node2out;
+
+    for (auto iter : m_targets) {
+        auto target = iter.second;
+
+        vector<int> in_degree;
+        CalcInDegree(target, dep_tree, &in_degree);
+
+        GenerateNinjaSubBuildInfo(target, dep_tree, in_degree, &node2out, &out);
+
+        unordered_set<string> obj_of_target;
+        GenerateNinjaObjBuildInfo(target, dep_tree, m_unity_batch_size,
+                                  &obj_of_target, &obj_dedup, pic_deps, &out);
+
+        string target_dep_libs;
+        if (target->GetType() == OMAKE_TYPE_BINARY ||
+            target->GetType() == OMAKE_TYPE_SHARED) {
+            target_dep_libs = GenerateTargetDepLibs(target, dep_tree, string(), &in_degree);
+        }
+
+        string rule;
+        if (target->GetType() == OMAKE_TYPE_STATIC) {
+            rule = "omake_ar";
+        } else if (target->HasCppSource()) {
+            rule = "omake_link_cxx";
+        } else {
+            rule = "omake_link_c";
+        }
+
+        out << "build " << GetGeneratedName(target) << ": " << rule;
+        GenerateObjects(obj_of_target, &out);
+
+        const string implicit_deps = GenerateNinjaImplicitDeps(target, node2out);
+        if (!implicit_deps.empty()) {
+            out << " |" << implicit_deps;
+        }
+        out << "\n";
+
+        if (target->GetType() != OMAKE_TYPE_STATIC) {
+            out << "  flags =";
+            target->ForEachDependency([&out] (const Dependency* dep) {
+                out << " $" << dep->GetName() << "_flags";
+            });
+            out << "\n";
+            string ldflags;
+            if (target->GetType() == OMAKE_TYPE_SHARED) {
+                ldflags = " -shared";
+            }
+            const string& linker = target->GetLinker().empty() ? m_linker : target->GetLinker();
+            if (!linker.empty()) {
+                ldflags += " -fuse-ld=" + linker;
+                if (debug && linker != "bfd") {
+                    ldflags += " -Wl,--gdb-index";
+                }
+            }
+            if (!ldflags.empty()) {
+                out << "  ldflags =" << ldflags << "\n";
+            }
+            if (!target_dep_libs.empty()) {
+                out << "  libs =" << target_dep_libs << "\n";
+            }
+        }
+        out << "\n";
+    }
+
+    out << "default";
+    for (auto iter : m_targets) {
+        out << " " << GetGeneratedName(iter.second);
     }
+    out << "\n";
 
-    return WriteFile(fname, content);
+    return out.Commit();
 }
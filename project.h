@@ -2,23 +2,82 @@
 #define __OMAKE_PROJECT_H__
 
 #include "target.h"
+#include "dep_cache.h"
+#include "dep_tree.h"
 #include <vector>
 #include <map>
+#include <set>
+
+/*
+  sub-projects and the dep tree built from them. `omake --watch` keeps one across runs:
+  a sub-project is evaluated again only after it is invalidated, and the tree is reused
+  as long as no sub-project is invalidated and the top project uses the same libraries.
+*/
+struct ResidentState final {
+    ResidentState() : loaded(false), tree_valid(false) {}
+
+    /* `dir` is evaluated again in the next run */
+    void Invalidate(const std::string& dir) {
+        cache.Erase(dir);
+        tree_valid = false;
+    }
+    /* the cached result of `dir` is kept unless its inputs are found changed */
+    void Recheck(const std::string& dir) {
+        cache.Unverify(dir);
+        tree_valid = false;
+    }
+
+    bool loaded; // `cache` is loaded from OMAKE_DEP_CACHE_FILE
+    DepCache cache;
+    bool tree_valid;
+    DepTree dep_tree;
+    std::vector<LibInfo> roots; // libraries of the top project `dep_tree` is built from
+
+private:
+    ResidentState(const ResidentState&);
+    ResidentState& operator=(const ResidentState&);
+};
 
 class Project final {
 public:
-    Project() : m_dep_counter(0) {}
+    Project();
 
     Target* CreateBinary(const char* name);
     Target* CreateStaticLibrary(const char* name);
     Target* CreateSharedLibrary(const char* name);
     Dependency* CreateDependency();
+    void EnableUnityBuild(int batch_size) { m_unity_batch_size = batch_size; }
+    int GetUnityBatchSize() const { return m_unity_batch_size; }
+    void EnableNonRecursiveBuild() { m_non_recursive = true; }
+    void EnableThinArchive() { m_thin_archive = true; }
+    void SetCompilerLauncher(const char* launcher) { m_launcher = launcher; }
+    void SetLinker(const char* linker) { m_linker = linker; }
+    void SetPgoTrainingCommand(const char* cmd) { m_pgo_training = cmd; }
+    /* not exported to lua. a temporary one is used by default. */
+    void SetResidentState(ResidentState* state) { m_resident = state; }
     Target* FindTarget(const std::string& name) const;
+    void ForEachTarget(const std::function<void (const Target*)>&) const;
+    /*
+      omake.lua files and dirs scanned by wildcards, along with the dir of the sub-project
+      using them, which is empty for this project. available after Generate*().
+    */
+    void ForEachGeneratorInput(const std::function<void (const std::string& input,
+                                                         const std::string& owner)>&) const;
     bool GenerateMakefile(const std::string& fname);
+    bool GenerateNinja(const std::string& fname, bool debug, const std::string& lto);
 
 private:
     unsigned long m_dep_counter;
+    int m_unity_batch_size; // default for dependencies, 0 means disabled
+    bool m_non_recursive; // build in-tree libraries in the same Makefile
+    bool m_thin_archive; // static libraries refer to objects instead of copying them
+    std::string m_base_dir; // dir of the omake.lua creating this project
+    std::string m_launcher; // e.g. ccache. prepended to compile commands only
+    std::string m_linker; // passed to `-fuse-ld=`. empty means the default of the compiler
+    std::string m_pgo_training; // run by `make pgo` between `pgo=gen` and `pgo=use` builds
     std::map<std::string, Target*> m_targets;
+    std::map<std::string, std::set<std::string>> m_generator_inputs; // input -> owners
+    ResidentState* m_resident;
 
 private:
     Project(const Project&);
@@ -0,0 +1,219 @@
+#include "stats.h"
+#include "utils.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring> // strerror()
+#include <cstdlib> // strtoull()
+using namespace std;
+
+/* one line per command: target, group, output, wall time(us), peak rss(KB), output size, status */
+struct StatsRecord final {
+    string target;
+    string group; // name of the dependency, or "link" for targets
+    string output;
+    uint64_t wall_us;
+    uint64_t maxrss_kb;
+    uint64_t size;
+    int status;
+};
+
+#define LINK_GROUP "link"
+
+static void AppendRecord(const char* log_file, const StatsRecord& rec) {
+    const string log_str(log_file);
+    const int offset = FindParentDirPos(log_str.data(), log_str.size());
+    if (offset > 0 && !MakeDirs(log_str.substr(0, offset))) {
+        return;
+    }
+
+    const string line = rec.target + "\t" + rec.group + "\t" + rec.output + "\t" +
+        std::to_string(rec.wall_us) + "\t" + std::to_string(rec.maxrss_kb) + "\t" +
+        std::to_string(rec.size) + "\t" + std::to_string(rec.status) + "\n";
+
+    // a single write() with O_APPEND keeps lines of parallel jobs from interleaving
+    int fd = open(log_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        cerr << "open stats log [" << log_file << "] failed: " << strerror(errno) << endl;
+        return;
+    }
+    if (write(fd, line.data(), line.size()) != (ssize_t)line.size()) {
+        cerr << "write stats log [" << log_file << "] failed: " << strerror(errno) << endl;
+    }
+    close(fd);
+}
+
+int RecordCommand(const char* log_file, const char* target, const char* group,
+                  const char* output, char* argv[]) {
+    const auto begin = chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr << "fork failed: " << strerror(errno) << endl;
+        return 127;
+    }
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        cerr << "exec [" << argv[0] << "] failed: " << strerror(errno) << endl;
+        _exit(127);
+    }
+
+    int wstatus = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    // peak rss of the compiler driver includes its waited children such as cc1plus
+    while (wait4(pid, &wstatus, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            cerr << "wait4 failed: " << strerror(errno) << endl;
+            return 127;
+        }
+    }
+
+    StatsRecord rec;
+    rec.target = target;
+    rec.group = group;
+    rec.output = output;
+    rec.wall_us = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - begin).count();
+    rec.maxrss_kb = usage.ru_maxrss;
+    struct stat st;
+    rec.size = (stat(output, &st) == 0) ? st.st_size : 0;
+    if (WIFEXITED(wstatus)) {
+        rec.status = WEXITSTATUS(wstatus);
+    } else if (WIFSIGNALED(wstatus)) {
+        rec.status = 128 + WTERMSIG(wstatus);
+    } else {
+        rec.status = 127;
+    }
+
+    AppendRecord(log_file, rec);
+    return rec.status;
+}
+
+static bool ParseRecord(const string& line, StatsRecord* rec) {
+    vector<string> fields;
+    size_t begin = 0;
+    while (true) {
+        size_t end = line.find('\t', begin);
+        if (end == string::npos) {
+            fields.push_back(line.substr(begin));
+            break;
+        }
+        fields.push_back(line.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    if (fields.size() != 7) {
+        return false;
+    }
+
+    rec->target = fields[0];
+    rec->group = fields[1];
+    rec->output = fields[2];
+    rec->wall_us = strtoull(fields[3].c_str(), nullptr, 10);
+    rec->maxrss_kb = strtoull(fields[4].c_str(), nullptr, 10);
+    rec->size = strtoull(fields[5].c_str(), nullptr, 10);
+    rec->status = atoi(fields[6].c_str());
+    return true;
+}
+
+struct StatsSummary final {
+    StatsSummary() : count(0), wall_us(0), maxrss_kb(0), size(0) {}
+    uint64_t count;
+    uint64_t wall_us;
+    uint64_t maxrss_kb;
+    uint64_t size;
+};
+
+static void AddToSummary(const StatsRecord& rec, StatsSummary* summary) {
+    ++summary->count;
+    summary->wall_us += rec.wall_us;
+    summary->size += rec.size;
+    if (rec.maxrss_kb > summary->maxrss_kb) {
+        summary->maxrss_kb = rec.maxrss_kb;
+    }
+}
+
+static void PrintSummaries(const char* title, const map<string, StatsSummary>& summaries) {
+    vector<pair<string, StatsSummary>> items(summaries.begin(), summaries.end());
+    sort(items.begin(), items.end(), [] (const pair<string, StatsSummary>& a,
+                                         const pair<string, StatsSummary>& b) -> bool {
+        return (a.second.wall_us > b.second.wall_us);
+    });
+
+    cout << title << ":" << endl
+         << "  " << setw(10) << "time(s)" << setw(8) << "cmds" << setw(14) << "peak rss(KB)"
+         << setw(14) << "size(KB)" << "  name" << endl;
+    for (auto& item : items) {
+        cout << "  " << setw(10) << fixed << setprecision(3) << item.second.wall_us / 1000000.0
+             << setw(8) << item.second.count << setw(14) << item.second.maxrss_kb
+             << setw(14) << item.second.size / 1024 << "  " << item.first << endl;
+    }
+    cout << endl;
+}
+
+#define REPORT_TOP_N 20
+
+int ReportStats(const char* log_file) {
+    ifstream ifs(log_file);
+    if (!ifs.is_open()) {
+        cerr << "open stats log [" << log_file << "] failed: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    // only the latest record of each output counts
+    map<string, StatsRecord> records;
+    string line;
+    while (getline(ifs, line)) {
+        StatsRecord rec;
+        if (!ParseRecord(line, &rec)) {
+            cerr << "skip invalid stats record [" << line << "]" << endl;
+            continue;
+        }
+        records[rec.output] = std::move(rec);
+    }
+
+    map<string, StatsSummary> by_target, by_group;
+    vector<const StatsRecord*> units;
+    for (auto& iter : records) {
+        const StatsRecord& rec = iter.second;
+        AddToSummary(rec, &by_target[rec.target]);
+        if (rec.group != LINK_GROUP) {
+            AddToSummary(rec, &by_group[rec.group]);
+            units.push_back(&rec);
+        }
+    }
+
+    PrintSummaries("by target", by_target);
+    PrintSummaries("by dependency", by_group);
+
+    sort(units.begin(), units.end(), [] (const StatsRecord* a, const StatsRecord* b) -> bool {
+        return (a->wall_us > b->wall_us);
+    });
+    if (units.size() > REPORT_TOP_N) {
+        units.resize(REPORT_TOP_N);
+    }
+
+    cout << "slowest translation units:" << endl
+         << "  " << setw(10) << "time(s)" << setw(14) << "peak rss(KB)" << setw(14) << "size(KB)"
+         << "  output" << endl;
+    for (auto rec : units) {
+        cout << "  " << setw(10) << fixed << setprecision(3) << rec->wall_us / 1000000.0
+             << setw(14) << rec->maxrss_kb << setw(14) << rec->size / 1024 << "  " << rec->output
+             << (rec->status == 0 ? "" : " (failed)") << endl;
+    }
+
+    return 0;
+}
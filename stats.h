@@ -0,0 +1,16 @@
+#ifndef __OMAKE_STATS_H__
+#define __OMAKE_STATS_H__
+
+#define OMAKE_STATS_LOG_FILE ".omake/stats.log"
+
+/*
+  runs `argv` and appends its wall time, peak RSS and the size of `output` to `log_file`.
+  returns the exit status of the command.
+*/
+int RecordCommand(const char* log_file, const char* target, const char* group,
+                  const char* output, char* argv[]);
+
+/* prints records of `log_file` aggregated by target and by dependency */
+int ReportStats(const char* log_file);
+
+#endif
@@ -1,12 +1,10 @@
 #include "target.h"
 #include "common.h"
 #include <iostream>
-#include <algorithm>
 using namespace std;
 
 void Target::AddDependency(const Dependency* dep) {
-    auto it = std::find(m_deps.begin(), m_deps.end(), dep);
-    if (it == m_deps.end()) {
+    if (m_dep_set.insert(dep).second) {
         m_deps.push_back(dep);
     } else {
         cerr << "AddDependency(): duplicated dependency ["
@@ -39,3 +37,13 @@ bool Target::HasCppSource() const {
 
     return false;
 }
+
+bool Target::HasPrecompiledHeader() const {
+    for (auto dep : m_deps) {
+        if (!dep->GetPrecompiledHeader().empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
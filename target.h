@@ -3,17 +3,25 @@
 
 #include "dependency.h"
 #include <vector>
+#include <unordered_set>
 
 class Target final {
 public:
-    Target(const char* name, int type)
-        : m_type(type), m_name(name) {}
+    /* `dir` is where the generated file goes */
+    Target(const char* name, int type, const std::string& dir = ".")
+        : m_type(type), m_name(name), m_dir(dir) {}
 
     int GetType() const { return m_type; }
     const std::string& GetName() const { return m_name; }
+    const std::string& GetDir() const { return m_dir; }
+
+    /* e.g. lld, mold or gold. overrides the linker of the project. */
+    void SetLinker(const char* linker) { m_linker = linker; }
+    const std::string& GetLinker() const { return m_linker; }
 
     bool HasCSource() const;
     bool HasCppSource() const;
+    bool HasPrecompiledHeader() const;
 
     void AddDependency(const Dependency*);
     void ForEachDependency(const std::function<void (const Dependency*)>&) const;
@@ -21,7 +29,10 @@ public:
 private:
     const int m_type;
     const std::string m_name;
-    std::vector<const Dependency*> m_deps;
+    const std::string m_dir;
+    std::string m_linker;
+    std::vector<const Dependency*> m_deps; // keep order of insertion
+    std::unordered_set<const Dependency*> m_dep_set; // index of `m_deps`
 
 private:
     Target(const Target&);
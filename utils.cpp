@@ -1,64 +1,114 @@
 #include "project.h"
 #include "target.h"
+#include "profiler.h"
 #include "cpputils/text_utils.h"
 #include "common.h"
 #include <iostream>
+#include <unordered_map>
+#include <deque>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring> // strerror()
 using namespace std;
 using namespace outils;
 
 #include "utils.h"
 using namespace luacpp;
 
-string RemoveDotAndDotDot(const string& path) {
-    vector<string> path_stack;
-    if (path[0] == '/') {
-        path_stack.push_back("/");
-    }
+static inline bool IsDot(const char* s, size_t l) {
+    return (l == 1 && s[0] == '.');
+}
+
+static inline bool IsDotDot(const char* s, size_t l) {
+    return (l == 2 && s[0] == '.' && s[1] == '.');
+}
+
+/*
+  components are appended to `res` directly and `..` truncates it to the previous '/', so that
+  the only allocation is the result. the first component of a relative path is kept as is, and
+  a leading `.` is replaced by the next component.
+*/
+string RemoveDotAndDotDot(string_view path) {
+    const bool is_abs = (!path.empty() && path[0] == '/');
+
+    string res;
+    res.reserve(path.size());
+
+    const char* end = path.data() + path.size();
+    for (const char* s = path.data(); s < end;) {
+        const char* e = (const char*)memchr(s, '/', end - s);
+        if (!e) {
+            e = end;
+        }
+        const char* comp = s;
+        const size_t l = e - s;
+        s = e + 1;
 
-    TextSplit(path.data(), path.size(), "/", 1, [&path_stack] (const char* s, unsigned int l) -> bool {
         if (l == 0) {
-            return true;
+            continue;
         }
 
-        if (path_stack.empty()) {
-            path_stack.push_back(string(s, l));
-        } else {
-            if (l == 1 && s[0] == '.') {
-                return true;
-            } else if (l == 2 && s[0] == '.' && s[1] == '.') {
-                if (path_stack.back() == "..") {
-                    path_stack.push_back(string(s, l));
-                } else if (path_stack.back() == ".") {
-                    path_stack.back() = string(s, l);
-                } else if (path_stack.size() == 1 && path_stack[0] == "/") {
-                    return true;
-                } else {
-                    path_stack.pop_back();
-                }
-                return true;
+        if (!is_abs && res.empty()) {
+            res.assign(comp, l);
+            continue;
+        }
+        if (IsDot(comp, l)) {
+            continue;
+        }
+
+        const size_t slash = res.rfind('/');
+        const size_t back_pos = (slash == string::npos) ? 0 : slash + 1;
+        const char* back = res.data() + back_pos;
+        const size_t back_len = res.size() - back_pos;
+
+        if (IsDotDot(comp, l)) {
+            if (IsDotDot(back, back_len)) {
+                res.push_back('/');
+                res.append(comp, l);
+            } else if (IsDot(back, back_len)) {
+                res.assign(comp, l);
+            } else if (res.empty()) { // is_abs: "/.." is "/"
+                continue;
             } else {
-                if (path_stack.back() == ".") {
-                    path_stack.back() = string(s, l);
-                } else {
-                    path_stack.push_back(string(s, l));
-                }
+                res.resize((slash == string::npos) ? 0 : slash);
             }
+        } else if (IsDot(back, back_len)) {
+            res.assign(comp, l);
+        } else {
+            res.push_back('/');
+            res.append(comp, l);
         }
-        return true;
-    });
-
-    if (path_stack.empty()) {
-        return string();
     }
 
-    string new_path;
-    if (path_stack[0] != "/") {
-        new_path = path_stack[0];
+    return res;
+}
+
+#define PATH_MEMO_MAX_SIZE 65536
+
+/*
+  for paths normalized again in every run of `omake --watch`. a hit costs about a third of
+  RemoveDotAndDotDot() but a miss about four times as much, see bench/path_bench. tables are
+  per thread so that no lock is needed. keys are views of strings in `keys`, which never moves
+  its elements, so that lookups do not allocate.
+*/
+string RemoveDotAndDotDotMemo(string_view path) {
+    thread_local unordered_map<string_view, string> memo;
+    thread_local deque<string> keys;
+
+    auto ref = memo.find(path);
+    if (ref != memo.end()) {
+        return ref->second;
     }
-    for (size_t i = 1; i < path_stack.size(); ++i) {
-        new_path.append("/" + path_stack[i]);
+
+    if (memo.size() >= PATH_MEMO_MAX_SIZE) { // `omake --watch` runs for a long time
+        memo.clear();
+        keys.clear();
     }
-    return new_path;
+
+    keys.emplace_back(path);
+    string res = RemoveDotAndDotDot(path);
+    memo.emplace(string_view(keys.back()), res);
+    return res;
 }
 
 int FindParentDirPos(const char* fpath, int plen) {
@@ -70,6 +120,23 @@ int FindParentDirPos(const char* fpath, int plen) {
     return -1;
 }
 
+/* like `mkdir -p` */
+bool MakeDirs(const string& path) {
+    for (size_t pos = 1; pos <= path.size(); ++pos) {
+        if (pos < path.size() && path[pos] != '/') {
+            continue;
+        }
+
+        const string dir = path.substr(0, pos);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            cerr << "create dir [" << dir << "] failed: " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /* -------------------------------------------------------------------------- */
 
 static int GenericGetItems(lua_State* l, int expected_argc,
@@ -177,6 +244,46 @@ static int l_AddIncludeDirectories(lua_State* l) {
     return 1;
 }
 
+static int l_AddPrecompiledHeader(lua_State* l) {
+    auto dep = *((Dependency**)lua_touserdata(l, 1));
+
+    if (lua_gettop(l) != 2 || !lua_isstring(l, 2)) {
+        cerr << "AddPrecompiledHeader() takes exactly 1 argument: a header file." << endl;
+    } else {
+        dep->AddPrecompiledHeader(lua_tostring(l, 2));
+    }
+
+    lua_pushvalue(l, 1);
+    return 1;
+}
+
+static int l_EnableUnityBuild(lua_State* l) {
+    auto dep = *((Dependency**)lua_touserdata(l, 1));
+
+    if (lua_gettop(l) != 2 || !lua_isnumber(l, 2) || lua_tointeger(l, 2) < 0) {
+        cerr << "EnableUnityBuild() takes exactly 1 argument: number of sources per unity file, 0 to disable." << endl;
+    } else {
+        dep->EnableUnityBuild(lua_tointeger(l, 2));
+    }
+
+    lua_pushvalue(l, 1);
+    return 1;
+}
+
+static int l_ExcludeFromUnityBuild(lua_State* l) {
+    auto dep = *((Dependency**)lua_touserdata(l, 1));
+
+    int ret = GenericGetItems(l, 2, [&dep] (lua_State* l, int index) {
+        dep->ExcludeFromUnityBuild(lua_tostring(l, index));
+    });
+    if (ret == -1) {
+        cerr << "ExcludeFromUnityBuild() takes exactly 1 argument: a file or a table containing file(s)." << endl;
+    }
+
+    lua_pushvalue(l, 1);
+    return 1;
+}
+
 static int l_AddDependencies(lua_State* l) {
     auto target = *((Target**)lua_touserdata(l, 1));
 
@@ -193,12 +300,20 @@ static int l_AddDependencies(lua_State* l) {
 }
 
 void InitLuaEnv(LuaState* l) {
+    ProfileScope scope("InitLuaEnv");
+
     l->RegisterClass<Project>("Project")
         .SetConstructor()
         .Set("CreateBinary", &Project::CreateBinary)
         .Set("CreateStaticLibrary", &Project::CreateStaticLibrary)
         .Set("CreateSharedLibrary", &Project::CreateSharedLibrary)
-        .Set("CreateDependency", &Project::CreateDependency);
+        .Set("CreateDependency", &Project::CreateDependency)
+        .Set("EnableUnityBuild", &Project::EnableUnityBuild)
+        .Set("SetCompilerLauncher", &Project::SetCompilerLauncher)
+        .Set("SetLinker", &Project::SetLinker)
+        .Set("SetPgoTrainingCommand", &Project::SetPgoTrainingCommand)
+        .Set("EnableNonRecursiveBuild", &Project::EnableNonRecursiveBuild)
+        .Set("EnableThinArchive", &Project::EnableThinArchive);
 
     l->RegisterClass<Dependency>()
         .Set("AddFlags", l_AddFlags)
@@ -206,8 +321,12 @@ void InitLuaEnv(LuaState* l) {
         .Set("AddStaticLibraries", l_AddStaticLibraries)
         .Set("AddSharedLibraries", l_AddSharedLibraries)
         .Set("AddSysLibraries", l_AddSysLibraries)
-        .Set("AddIncludeDirectories", l_AddIncludeDirectories);
+        .Set("AddIncludeDirectories", l_AddIncludeDirectories)
+        .Set("AddPrecompiledHeader", l_AddPrecompiledHeader)
+        .Set("EnableUnityBuild", l_EnableUnityBuild)
+        .Set("ExcludeFromUnityBuild", l_ExcludeFromUnityBuild);
 
     l->RegisterClass<Target>()
-        .Set("AddDependencies", l_AddDependencies);
+        .Set("AddDependencies", l_AddDependencies)
+        .Set("SetLinker", &Target::SetLinker);
 }
@@ -3,9 +3,13 @@
 
 #include "lua-cpp/luacpp.h"
 #include <string>
+#include <string_view>
 
 void InitLuaEnv(luacpp::LuaState* l);
-std::string RemoveDotAndDotDot(const std::string& path);
+std::string RemoveDotAndDotDot(std::string_view path);
+/* the same with a memo table, for paths normalized over and over */
+std::string RemoveDotAndDotDotMemo(std::string_view path);
 int FindParentDirPos(const char* fpath, int len);
+bool MakeDirs(const std::string& path);
 
 #endif
@@ -0,0 +1,181 @@
+#include "watch.h"
+#include "utils.h"
+#include <iostream>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+using namespace std;
+
+#define WATCH_SETTLE_MS 50
+
+#define WATCH_DIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_DELETE_SELF | IN_MOVE_SELF)
+
+Watcher::~Watcher() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool Watcher::Init() {
+    m_fd = inotify_init1(IN_CLOEXEC);
+    if (m_fd < 0) {
+        cerr << "inotify_init1 failed: " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+int Watcher::Watch(const vector<pair<string, string>>& inputs, set<string>* owners) {
+    int nr_added = 0;
+    for (auto& input : inputs) {
+        const string& path = input.first;
+        const string& owner = input.second;
+
+        struct stat st;
+        bool is_dir = (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+
+        // removed dirs are watched through their parents until they are created again
+        string dir, name;
+        if (is_dir) {
+            dir = path;
+        } else {
+            int pos = FindParentDirPos(path.data(), path.size());
+            if (pos < 0) {
+                dir = ".";
+                name = path;
+            } else {
+                dir = (pos == 0) ? "/" : path.substr(0, pos);
+                name = path.substr(pos + 1);
+            }
+        }
+
+        // a dir may be watched both as a whole and for files in it. without IN_MASK_ADD the
+        // mask added last replaces the previous one.
+        uint32_t mask = WATCH_DIR_EVENTS | IN_ONLYDIR | IN_MASK_ADD;
+        if (!is_dir) {
+            mask |= IN_CLOSE_WRITE | IN_ATTRIB;
+        }
+        // the same dir gets the same wd unless it is replaced by a new one
+        int wd = inotify_add_watch(m_fd, dir.c_str(), mask);
+        if (wd < 0) {
+            cerr << "watch [" << dir << "] failed: " << strerror(errno) << endl;
+            continue;
+        }
+
+        auto& watched = m_wd2dir[wd];
+        auto& dst = is_dir ? watched.owners : watched.files[name];
+        if (dst.insert(owner).second) {
+            ++nr_added;
+            if (owners) {
+                owners->insert(owner);
+            }
+        }
+    }
+    return nr_added;
+}
+
+void Watcher::GetOwners(const WatchedDir& watched, set<string>* owners) {
+    owners->insert(watched.owners.begin(), watched.owners.end());
+    for (auto& iter : watched.files) {
+        owners->insert(iter.second.begin(), iter.second.end());
+    }
+}
+
+/* returns 1 if something changed, 0 if not and -1 if an error occurs */
+int Watcher::ReadEvents(set<string>* owners) {
+    char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+
+    ssize_t len = read(m_fd, buf, sizeof(buf));
+    if (len < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return 0;
+        }
+        cerr << "read inotify events failed: " << strerror(errno) << endl;
+        return -1;
+    }
+
+    int changed = 0;
+    for (char* p = buf; p < buf + len;) {
+        auto e = (const inotify_event*)p;
+        p += sizeof(inotify_event) + e->len;
+
+        if (e->mask & IN_Q_OVERFLOW) { // events are lost. anything may have changed.
+            for (auto& iter : m_wd2dir) {
+                GetOwners(iter.second, owners);
+            }
+            changed = 1;
+            continue;
+        }
+
+        auto ref = m_wd2dir.find(e->wd);
+        if (ref == m_wd2dir.end()) {
+            continue;
+        }
+        if (e->mask & IN_IGNORED) { // the dir is gone
+            m_wd2dir.erase(ref);
+            continue;
+        }
+        if (e->len > 0 && m_ignored.count(e->name) > 0) {
+            continue;
+        }
+
+        const WatchedDir& watched = ref->second;
+        if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            GetOwners(watched, owners);
+            changed = 1;
+            continue;
+        }
+        if (e->len > 0) {
+            auto file = watched.files.find(e->name);
+            if (file != watched.files.end()) {
+                owners->insert(file->second.begin(), file->second.end());
+                changed = 1;
+            }
+        }
+        if (!watched.owners.empty() &&
+            (e->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+            owners->insert(watched.owners.begin(), watched.owners.end());
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+bool Watcher::Wait(set<string>* owners) {
+    if (m_wd2dir.empty()) {
+        cerr << "nothing to watch" << endl;
+        return false;
+    }
+
+    int timeout = -1; // waits for the first change without limit
+    while (true) {
+        struct pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int ret = poll(&pfd, 1, timeout);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "poll failed: " << strerror(errno) << endl;
+            return false;
+        }
+        if (ret == 0) {
+            return true; // settled
+        }
+
+        ret = ReadEvents(owners);
+        if (ret < 0) {
+            return false;
+        }
+        if (ret > 0) {
+            timeout = WATCH_SETTLE_MS;
+        }
+    }
+}
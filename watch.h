@@ -0,0 +1,57 @@
+#ifndef __OMAKE_WATCH_H__
+#define __OMAKE_WATCH_H__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+  dirs are watched for entries being added or removed, files for being written or
+  replaced. events are queued from the time a path is watched, so that changes made
+  while generating are not lost. each path is watched for one or more owners, which
+  are reported when it changes.
+*/
+class Watcher final {
+public:
+    Watcher() : m_fd(-1) {}
+    ~Watcher();
+
+    bool Init();
+    /*
+      `inputs` are pairs of (path, owner). existing watches are kept. returns the number of
+      pairs that were not watched before, whose owners are added to `owners` if it is not null.
+    */
+    int Watch(const std::vector<std::pair<std::string, std::string>>& inputs,
+              std::set<std::string>* owners);
+    /* entries with this name are not inputs, e.g. generated files. their events are dropped. */
+    void Ignore(const std::string& name) {
+        m_ignored.insert(name);
+    }
+    /*
+      blocks until something changes and adds owners of changed paths to `owners`. events
+      arriving shortly after the first one are merged.
+    */
+    bool Wait(std::set<std::string>* owners);
+
+private:
+    struct WatchedDir final {
+        std::set<std::string> owners; // of the dir itself. any entry added or removed counts.
+        std::unordered_map<std::string, std::set<std::string>> files; // watched files -> owners
+    };
+
+    static void GetOwners(const WatchedDir&, std::set<std::string>* owners);
+    int ReadEvents(std::set<std::string>* owners);
+
+private:
+    int m_fd;
+    std::unordered_map<int, WatchedDir> m_wd2dir;
+    std::unordered_set<std::string> m_ignored;
+
+private:
+    Watcher(const Watcher&);
+    Watcher& operator=(const Watcher&);
+};
+
+#endif